@@ -9,22 +9,28 @@
 #include "sqcheckbox.h"
 #include "sqlineedit.h"
 
+#include <util/facetindex.h>
 #include <util/fileutil.h>
 
+#include <QAbstractItemView>
 #include <QAction>
 #include <QActionGroup>
 #include <QCheckBox>
+#include <QCompleter>
 #include <QDesktopServices>
 #include <QEvent>
 #include <QLabel>
 #include <QMenuBar>
 #include <QSplitter>
+#include <QStandardItemModel>
 #include <QUrl>
 #include <QVBoxLayout>
 #include <QWindowStateChangeEvent>
 
 #include <sodium/sodium.h>
 
+#include <functional>
+
 using namespace sodium;
 
 const char kGeometry[] = "Geometry";
@@ -35,6 +41,7 @@ const char kCurrentPath[] = "CurrentPath";
 const char kIncludeSubFolders[] = "IncludeSubFolders";
 const char kVideosOnly[] = "VideosOnly";
 const char kAudioEnabled[] = "AudioEnabled";
+const char kIncrementalLoading[] = "IncrementalLoading";
 const char kTags[] = "Tags";
 
 Settings::Setting::Setting(const QByteArray &key, const cell<QVariant> &value)
@@ -287,8 +294,14 @@ public:
     SQAction *searchAction() { return m_searchAction; }
     const cell<QString> &path() { return m_path; }
     const cell<QString> &filterString() { return m_filterString; }
+    // values of the camera settings with the number of items, for completing filters
+    void setFacetCounts(const std::function<QList<Util::FacetCount>(Util::Facet)> &facetCounts)
+    {
+        m_facetCounts = facetCounts;
+    }
 
 private:
+    std::function<QList<Util::FacetCount>(Util::Facet)> m_facetCounts;
     SQAction *m_recursiveAction = nullptr;
     SQAction *m_videosOnlyAction = nullptr;
     SQAction *m_searchAction = nullptr;
@@ -297,6 +310,17 @@ private:
     Unsubscribe m_unsubscribe;
 };
 
+// start and length of the filter term that ends at the cursor
+static std::pair<int, int> termAtCursor(const QLineEdit &edit)
+{
+    const QString text = edit.text();
+    const int cursor = edit.cursorPosition();
+    int start = cursor;
+    while (start > 0 && !text.at(start - 1).isSpace())
+        --start;
+    return {start, cursor - start};
+}
+
 FileTreeView::FileTreeView(Settings &settings, QWidget *parent)
     : SQWidgetBase<QWidget>(parent)
     , m_path(QString())
@@ -318,8 +342,52 @@ FileTreeView::FileTreeView(Settings &settings, QWidget *parent)
 
     SQLineEdit *filter = new SQLineEdit;
     filter->setClearButtonEnabled(true);
+    filter->setToolTip(
+        tr("Words match file names and tags.\n"
+           "camera:, lens:, iso: and focal: filter by camera settings without scanning again, "
+           "for example \"camera:x-t4 focal:23 iso:>3200\" or \"focal:20-35\".\n"
+           "near:latitude,longitude,km and box:south,west,north,east filter by location."));
     m_filterString = filter->text();
 
+    // completes "camera:", "lens:", "iso:" and "focal:" terms with the values of the shown items
+    auto facetValues = new QStandardItemModel(this);
+    auto completer = new QCompleter(facetValues, this);
+    completer->setWidget(filter);
+    completer->setCaseSensitivity(Qt::CaseInsensitive);
+    completer->setCompletionRole(Qt::UserRole);
+    connect(filter, &QLineEdit::textEdited, this, [this, filter, completer, facetValues] {
+        const auto [start, length] = termAtCursor(*filter);
+        const QString term = filter->text().mid(start, length);
+        const std::vector<Util::Facet> facets
+            = {Util::Facet::Camera, Util::Facet::Lens, Util::Facet::Iso, Util::Facet::FocalLength};
+        const auto facet = std::find_if(facets.cbegin(), facets.cend(), [term](Util::Facet f) {
+            return term.startsWith(Util::facetPrefix(f), Qt::CaseInsensitive);
+        });
+        if (!m_facetCounts || facet == facets.cend()) {
+            completer->popup()->hide();
+            return;
+        }
+        facetValues->clear();
+        for (const Util::FacetCount &count : m_facetCounts(*facet)) {
+            auto item = new QStandardItem(tr("%1 (%2)").arg(count.value).arg(count.count));
+            // terms end at white space, and text facets match a part of the value
+            item->setData(Util::facetPrefix(*facet) + count.value.section(' ', 0, 0),
+                          Qt::UserRole);
+            facetValues->appendRow(item);
+        }
+        completer->setCompletionPrefix(term);
+        completer->complete();
+    });
+    connect(completer,
+            qOverload<const QString &>(&QCompleter::activated),
+            this,
+            [filter](const QString &completion) {
+                const auto [start, length] = termAtCursor(*filter);
+                const QString text = filter->text();
+                filter->setText(text.left(start) + completion + text.mid(start + length));
+                filter->setCursorPosition(start + completion.size());
+            });
+
     stream_loop<bool> sIsRecursive;
     auto recursiveCheckBox = new SQCheckBox(recursiveText);
     recursiveCheckBox->setChecked(sIsRecursive, false);
@@ -379,6 +447,7 @@ BrowserWindow::BrowserWindow(QWidget *parent)
     m_model->setPath(tree->path());
     m_model->setRecursive(tree->recursiveAction()->isChecked());
     m_model->setFilterString(tree->filterString());
+    tree->setFacetCounts([this](Util::Facet facet) { return m_model->facetCounts(facet); });
     m_model->setVideosOnly(tree->videosOnlyAction()->isChecked());
     m_model->setSortKey(cSortKey);
 
@@ -466,6 +535,14 @@ BrowserWindow::BrowserWindow(QWidget *parent)
     viewMenu->addAction(tree->recursiveAction());
     viewMenu->addAction(tree->videosOnlyAction());
 
+    stream_loop<bool> sRestoreIncrementalLoading;
+    auto incrementalLoading = new SQAction(tr("Load Items Incrementally"), viewMenu);
+    incrementalLoading->setChecked(sRestoreIncrementalLoading, false);
+    sRestoreIncrementalLoading.loop(
+        m_settings.add(kIncrementalLoading, incrementalLoading->isChecked()));
+    m_model->setIncrementalLoading(incrementalLoading->isChecked());
+    viewMenu->addAction(incrementalLoading);
+
     stream_loop<MediaDirectoryModel::SortKey> sRestoreSortKey;
     const auto sortMenu = createSortMenu(sRestoreSortKey);
     cSortKey.loop(sortMenu.cSortKey);
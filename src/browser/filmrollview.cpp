@@ -6,6 +6,7 @@
 #include "sqlistview.h"
 
 #include <QAbstractItemDelegate>
+#include <QElapsedTimer>
 #include <QEvent>
 #include <QFont>
 #include <QPainter>
@@ -29,6 +30,16 @@ protected:
     void paintEvent(QPaintEvent *pe) override;
 
 private:
+    void updateThumbnailSize();
+    void scrolled(int value);
+    void updateViewport(bool isScrollingFast);
+
+    Unsubscribe m_unsubscribe;
+    std::unique_ptr<SQTimer> m_thumbnailSizeTimer;
+    QElapsedTimer m_scrollTimer;
+    QTimer m_scrollSettleTimer;
+    int m_lastScrollValue = 0;
+    int m_scrollDirection = 0;
     cell<OptionalMediaItem> m_currentItem;
     sodium::cell_sink<QString> m_frontDate; // date of the first visible item
     sodium::cell<QFont> m_frontDateFont;
@@ -293,16 +304,98 @@ Fotoroll::Fotoroll(const stream<boost::optional<int>> &sCurrentIndex)
                                                         textSize.height());
                                        })
                                  .updates());
+
+    // thumbnails in a new size are only created when resizing settled
+    m_thumbnailSizeTimer = std::make_unique<SQTimer>(
+        viewportSize().updates().map([](const QSize &) { return unit(); }));
+    m_thumbnailSizeTimer->setSingleShot(true);
+    m_thumbnailSizeTimer->setInterval(300);
+    m_unsubscribe.insert_or_assign("thumbnailsize",
+                                   m_thumbnailSizeTimer->timedOut().listen(
+                                       ensureSameThread<unit>(this, [this](unit) {
+                                           updateThumbnailSize();
+                                           updateViewport(false);
+                                       })));
+
+    // scrolling is fast until no scrolling happened for a while
+    m_scrollSettleTimer.setSingleShot(true);
+    m_scrollSettleTimer.setInterval(150);
+    connect(&m_scrollSettleTimer, &QTimer::timeout, this, [this] {
+        // without scrolling, items on both sides are prefetched
+        m_scrollDirection = 0;
+        updateViewport(false);
+    });
+    connect(horizontalScrollBar(), &QScrollBar::valueChanged, this, &Fotoroll::scrolled);
 }
 
 void Fotoroll::setMediaModel(MediaDirectoryModel *model)
 {
     setModel(model);
     m_dateLabel->setVisible(model->showDateDisplay());
+    updateThumbnailSize();
+    // the model forgets the viewport when it is reset, and the items are only laid out later
+    connect(model, &QAbstractItemModel::modelReset, this, [this] {
+        m_scrollTimer.invalidate();
+        m_scrollDirection = 0;
+        m_scrollSettleTimer.start();
+    });
+    connect(model, &QAbstractItemModel::rowsInserted, this, [this] {
+        if (!m_scrollSettleTimer.isActive())
+            m_scrollSettleTimer.start();
+    });
+}
+
+void Fotoroll::updateThumbnailSize()
+{
+    auto mediaModel = static_cast<MediaDirectoryModel *>(model());
+    if (!mediaModel)
+        return;
+    // thumbnails are painted with the height of the view, and the size is for the longer side,
+    // which is 1.5 times the height for landscape photos in 3:2
+    const int height = viewport()->height() - 2 * MARGIN;
+    mediaModel->setRequiredThumbnailSize(qRound(height * devicePixelRatioF() * 1.5));
+}
+
+void Fotoroll::scrolled(int value)
+{
+    // the first change has nothing to measure the speed against
+    const qint64 elapsed = m_scrollTimer.isValid() ? std::max(qint64(1), m_scrollTimer.restart())
+                                                   : 0;
+    if (!m_scrollTimer.isValid())
+        m_scrollTimer.start();
+    const int delta = value - m_lastScrollValue;
+    m_lastScrollValue = value;
+    if (delta != 0)
+        m_scrollDirection = delta > 0 ? 1 : -1;
+    // more than 4 viewport widths per second
+    const bool isScrollingFast = elapsed > 0
+                                 && qint64(std::abs(delta)) * 1000
+                                        > 4 * qint64(viewport()->width()) * elapsed;
+    updateViewport(isScrollingFast);
+    m_scrollSettleTimer.start();
+}
+
+void Fotoroll::updateViewport(bool isScrollingFast)
+{
+    auto mediaModel = static_cast<MediaDirectoryModel *>(model());
+    if (!mediaModel)
+        return;
+    const int rows = mediaModel->rowCount(QModelIndex());
+    if (rows == 0)
+        return;
+    const int y = viewport()->height() / 2;
+    const QModelIndex first = indexAt({0, y});
+    const QModelIndex last = indexAt({viewport()->width() - 1, y});
+    mediaModel->setViewport(first.isValid() ? first.row() : 0,
+                            last.isValid() ? last.row() : rows - 1,
+                            m_scrollDirection,
+                            isScrollingFast);
 }
 
 bool Fotoroll::event(QEvent *ev)
 {
+    if (ev->type() == QEvent::DevicePixelRatioChange)
+        updateThumbnailSize();
     if (ev->type() == QEvent::Resize) {
         transaction t; // avoid updating cells for deselecting and selecting
         const auto selection = selectionModel()->selection();
@@ -0,0 +1,38 @@
+#include "framescheduler.h"
+
+#include <QGuiApplication>
+#include <QScreen>
+
+static int frameInterval()
+{
+    const QScreen *screen = QGuiApplication::primaryScreen();
+    const qreal refreshRate = screen && screen->refreshRate() > 0 ? screen->refreshRate() : 60;
+    return qMax(1, qRound(1000 / refreshRate));
+}
+
+FrameScheduler::FrameScheduler(const std::function<void()> &update)
+    : m_update(update)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    m_timer.callOnTimeout(this, &FrameScheduler::run);
+}
+
+void FrameScheduler::request()
+{
+    if (m_timer.isActive())
+        return;
+    const int interval = frameInterval();
+    const qint64 sinceLastRun = m_lastRun.isValid() ? m_lastRun.elapsed() : interval;
+    if (sinceLastRun >= interval)
+        run();
+    else
+        m_timer.start(int(interval - sinceLastRun));
+}
+
+void FrameScheduler::run()
+{
+    m_timer.stop();
+    m_lastRun.start();
+    m_update();
+}
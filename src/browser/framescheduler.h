@@ -0,0 +1,24 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include <functional>
+
+// Runs an update function at most once per display frame.
+// A request after an idle frame runs the update immediately, requests that come in faster are
+// collected and handled together at the start of the next frame.
+class FrameScheduler : public QObject
+{
+public:
+    explicit FrameScheduler(const std::function<void()> &update);
+
+    void request();
+
+private:
+    void run();
+
+    std::function<void()> m_update;
+    QTimer m_timer;
+    QElapsedTimer m_lastRun;
+};
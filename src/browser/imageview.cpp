@@ -53,6 +53,12 @@ void paintDuration(QPainter *painter,
 
 static QImage imageForFilePath(const QString &filePath, Util::Orientation orientation)
 {
+    // decoding RAW data would take far too long, camera files embed full size previews
+    if (Util::isRawImage(filePath)) {
+        const QImage preview = Util::largestEmbeddedPreview(filePath);
+        if (!preview.isNull())
+            return preview;
+    }
     QImage image(filePath);
     return image.transformed(Util::matrixForOrientation(image.size(), orientation).toTransform());
 }
@@ -1,21 +1,50 @@
 #include "mediadirectorymodel.h"
 
+#include <util/boundedqueue.h>
+#include <util/fileprobe.h>
 #include <util/fileutil.h>
 #include <util/tags.h>
+#include <util/tagstore.h>
 
+#include <QBuffer>
 #include <QDir>
 #include <QDirIterator>
+#include <QElapsedTimer>
 #include <QImageReader>
+#include <QLoggingCategory>
 #include <QMimeDatabase>
 #include <QRegularExpression>
 #include <QtConcurrent>
 
 #include <algorithm>
+#include <chrono>
+#include <limits>
 #include <random>
 
 using namespace sodium;
 
+Q_LOGGING_CATEGORY(logScan, "browser.scan", QtWarningMsg)
 Q_GLOBAL_STATIC(QThreadPool, sThreadPool);
+// threads of the scan stages, separate so they cannot starve each other
+Q_GLOBAL_STATIC(QThreadPool, sScanThreadPool);
+
+// enough for the meta data segments of most JPEGs
+const qsizetype kHeaderSize = 64 * 1024;
+// incremental loading exposes and materializes items in pages of this size
+const int kPageSize = 500;
+// materialized items further away from the last requested row are dropped again
+const int kMaterializeDistance = 2 * kPageSize;
+const std::size_t kMaxMaterializedItems = 4 * kPageSize;
+// batches that can wait between two scan stages
+const std::size_t kQueueCapacity = 8;
+const int kClassifyConcurrency = 2;
+// milliseconds between reports of scan results
+const qint64 kReportInterval = 200;
+// memory for thumbnail pixmaps and compressed thumbnails, can be changed with
+// PHOTOBROWSER_THUMBNAIL_MEMORY_MB
+const qint64 kDefaultThumbnailBudgetMb = 512;
+// JPEG quality of compressed thumbnails
+const int kCompressedThumbnailQuality = 85;
 
 namespace {
 
@@ -57,45 +86,52 @@ void sortByKey(const MediaDirectoryModel::SortKey key, MediaItems &items)
         std::sort(items.begin(), items.end(), itemLessThan(key));
 }
 
+void sortByKey(const MediaDirectoryModel::SortKey key, MediaItemStore &items)
+{
+    if (key == MediaDirectoryModel::SortKey::Random) {
+        std::random_device rd;
+        items.shuffle(std::mt19937(rd()));
+    } else {
+        items.sort(itemLessThan(key));
+    }
+}
+
 MediaDirectoryModel::ResultList addSorted(MediaDirectoryModel::SortKey key,
-                                          MediaItems &target,
+                                          MediaItemStore &target,
                                           MediaItems source)
 {
     sortByKey(key, source);
-    // TODO make more performant by not inserting, but inserting into a new container,
-    // like std::merge
+    const auto lessThan = itemLessThan(key);
     MediaDirectoryModel::ResultList resultList;
-    target.reserve(target.size() + source.size());
     auto current = source.begin();
     const auto end = source.end();
-    auto insertionPoint = target.begin();
+    std::size_t insertionIndex = 0;
     while (current != end) {
-        while (insertionPoint != target.end() && itemLessThan(key)(*insertionPoint, *current))
-            ++insertionPoint;
-        auto currentEnd = insertionPoint != target.end() ? current + 1 : source.end();
-        while (currentEnd != source.end() && itemLessThan(key)(*currentEnd, *insertionPoint))
-            ++currentEnd;
-        const auto insertionIndex = std::distance(target.begin(), insertionPoint);
+        insertionIndex = target.lowerBound(*current, lessThan, insertionIndex);
+        // all following source items that still go before the target item at insertionIndex
+        const auto currentEnd = insertionIndex < target.size()
+                                    ? std::lower_bound(current + 1,
+                                                       end,
+                                                       target.at(insertionIndex),
+                                                       lessThan)
+                                    : end;
         const auto insertionCount = std::distance(current, currentEnd);
-        insertionPoint = target.insert(insertionPoint, current, currentEnd);
+        target.insert(insertionIndex, current, currentEnd);
         resultList.push_back({insertionIndex, MediaItems(current, currentEnd)});
-        insertionPoint += insertionCount;
+        insertionIndex += insertionCount;
         current = currentEnd;
     }
     return resultList;
 }
 
 MediaDirectoryModel::ResultList mergeResults(MediaDirectoryModel::SortKey key,
-                                             MediaItems &target,
+                                             MediaItemStore &target,
                                              const MediaItems &source)
 {
     if (key != MediaDirectoryModel::SortKey::Random)
         return addSorted(key, target, source);
     // random
-    // TODO make more performant by not inserting, but first creating the indicees, then inserting
-    // piece by piece from current & add lists into the result list.
     MediaDirectoryModel::ResultList resultList;
-    target.reserve(target.size() + source.size());
     std::random_device rd;
     std::mt19937 g(rd());
     using distr_t = std::uniform_int_distribution<MediaItems::size_type>;
@@ -103,7 +139,7 @@ MediaDirectoryModel::ResultList mergeResults(MediaDirectoryModel::SortKey key,
     distr_t distribute;
     for (const MediaItem &item : source) {
         const auto insertionIndex = distribute(g, distr_param_t(0, target.size()));
-        target.insert(target.begin() + insertionIndex, item);
+        target.insert(insertionIndex, item);
         resultList.push_back({insertionIndex, {item}});
     }
     return resultList;
@@ -111,11 +147,39 @@ MediaDirectoryModel::ResultList mergeResults(MediaDirectoryModel::SortKey key,
 
 } // namespace
 
+// The facet conditions (like "iso:>3200" or "near:48.14,11.58,5") of the filter, and the
+// rest, which is matched against file names and tags while scanning.
+static std::pair<Util::FacetQuery, QString> splitFilterString(const QString &filterString)
+{
+    static const QRegularExpression whiteSpace("\\s+");
+    Util::FacetQuery query;
+    QStringList rest;
+    for (const QString &term : filterString.split(whiteSpace, Qt::SkipEmptyParts)) {
+        if (const std::optional<Util::FacetCondition> condition = Util::parseFacetCondition(term))
+            query.conditions.push_back(*condition);
+        else if (const std::optional<Util::GeoArea> area = Util::parseGeoArea(term))
+            query.areas.push_back(*area);
+        else
+            rest.append(term);
+    }
+    return {query, rest.join(' ')};
+}
+
+static qint64 thumbnailBudget()
+{
+    bool ok = false;
+    const int mb = qEnvironmentVariableIntValue("PHOTOBROWSER_THUMBNAIL_MEMORY_MB", &ok);
+    return qint64(ok && mb > 0 ? mb : kDefaultThumbnailBudgetMb) * 1024 * 1024;
+}
+
 MediaDirectoryModel::MediaDirectoryModel()
-    : m_path(QString())
+    : m_updateScheduler([this] { flushUpdates(); })
+    , m_thumbnailBudget(thumbnailBudget())
+    , m_path(QString())
     , m_isRecursive(false)
     , m_filterString(QString())
     , m_videosOnly(false)
+    , m_isIncremental(false)
     , m_sortKey(SortKey::ExifCreation)
     , m_showDateDisplay(true)
     , m_uniqueTags(QSet<QString>())
@@ -130,22 +194,15 @@ MediaDirectoryModel::MediaDirectoryModel()
             this,
             [this](const QString &resolvedFilePath,
                    const QPixmap &pixmap,
+                   int size,
                    std::optional<qint64> duration) {
-                for (int i = 0; i < m_items.size(); ++i) {
-                    MediaItem &item = m_items.at(i);
-                    if (item.resolvedFilePath == resolvedFilePath) {
-                        item.thumbnail = pixmap;
-                        if (duration)
-                            item.metaData.duration = duration;
-                        const QModelIndex mi = index(i, 0, QModelIndex());
-                        emit dataChanged(mi, mi, {int(Role::Thumbnail)});
-                    }
-                }
+                m_pendingThumbnails.insert(resolvedFilePath, {pixmap, duration, false, size});
+                m_updateScheduler.request();
             });
     connect(&m_futureWatcher, &QFutureWatcherBase::resultReadyAt, this, [this](int index) {
         // TODO using futureWatcher results is inefficient because it keeps the intermediate states
-        for (const auto &value : m_futureWatcher.resultAt(index))
-            insertItems(value.first, value.second);
+        m_pendingResults.push_back(m_futureWatcher.resultAt(index));
+        m_updateScheduler.request();
     });
     setSortKey(SortKey::ExifCreation);
 }
@@ -153,6 +210,7 @@ MediaDirectoryModel::MediaDirectoryModel()
 MediaDirectoryModel::~MediaDirectoryModel()
 {
     cancelAndWait();
+    Util::TagStore::instance().flush();
 }
 
 void MediaDirectoryModel::setPath(const sodium::cell<QString> &path)
@@ -184,10 +242,14 @@ void MediaDirectoryModel::setSortKey(const sodium::cell<SortKey> &sortKey)
 void MediaDirectoryModel::setFilterString(const sodium::cell<QString> &filterString)
 {
     m_filterString = filterString;
-    m_unsubscribe.insert_or_assign("filterString",
-                                   m_filterString.listen(post<QString>(this, [this](QString) {
-                                       load(); /*trigger reload*/
-                                   })));
+    m_unsubscribe.insert_or_assign(
+        "filterString", m_filterString.listen(post<QString>(this, [this](QString filterString) {
+            const auto [query, scanFilter] = splitFilterString(filterString);
+            if (scanFilter == m_scanFilter && !m_futureWatcher.isRunning())
+                setFacetQuery(query);
+            else
+                load(); /*trigger reload*/
+        })));
 }
 
 void MediaDirectoryModel::setVideosOnly(const sodium::cell<bool> &videosOnly)
@@ -198,6 +260,15 @@ void MediaDirectoryModel::setVideosOnly(const sodium::cell<bool> &videosOnly)
     })));
 }
 
+void MediaDirectoryModel::setIncrementalLoading(const sodium::cell<bool> &incremental)
+{
+    m_isIncremental = incremental;
+    m_unsubscribe.insert_or_assign("incremental",
+                                   m_isIncremental.listen(post<bool>(this, [this](bool) {
+                                       load(); /*trigger reload*/
+                                   })));
+}
+
 void MediaDirectoryModel::setToggleTag(
     const sodium::stream<std::pair<OptionalMediaItem, QString>> &sToggleTag)
 {
@@ -211,7 +282,8 @@ void MediaDirectoryModel::setToggleTag(
                                                    tags.removeAll(toTag.second);
                                                else
                                                    tags.append(toTag.second);
-                                               Util::setTags(toTag.first->filePath, tags);
+                                               Util::setTags(toTag.first->resolvedFilePath,
+                                                             tags);
                                                auto it = std::find_if(m_items.begin(),
                                                                       m_items.end(),
                                                                       [toTag](
@@ -222,8 +294,9 @@ void MediaDirectoryModel::setToggleTag(
                                                                       });
                                                if (it != m_items.end()) {
                                                    it->metaData.tags = tags;
-                                                   const int i = std::distance(m_items.begin(), it);
-                                                   const QModelIndex idx = index(i, 0);
+                                                   it->cachedToolTip.clear();
+                                                   const QModelIndex idx = index(int(it.index()),
+                                                                                 0);
                                                    dataChanged(idx, idx);
                                                }
                                            }
@@ -259,14 +332,88 @@ static OptionalRegExList filterRegexFromString(const QString &filterString)
     return result;
 }
 
-static void iterateDirectory(QPromise<QFileInfoList> &promise,
-                             QPromise<MediaDirectoryModel::TopLevelResultType> &topLevelPromise,
-                             const QString &path,
-                             const bool recursive)
+namespace {
+
+class Candidate
+{
+public:
+    QFileInfo entry;
+    QString resolvedFilePath;
+    MediaType type;
+};
+
+using Candidates = std::vector<Candidate>;
+using CancelCheck = std::function<bool()>;
+
+// for measuring the throughput of the scan stages
+class StageStats
+{
+public:
+    explicit StageStats(const char *name)
+        : name(name)
+    {}
+
+    void add(qint64 nsecs)
+    {
+        ++batches;
+        busyNsecs += nsecs;
+    }
+
+    const char *name;
+    std::atomic<qint64> batches{0};
+    std::atomic<qint64> busyNsecs{0};
+};
+
+QDebug operator<<(QDebug debug, const StageStats &stats)
+{
+    QDebugStateSaver saver(debug);
+    debug.nospace() << stats.name << ": " << stats.batches.load() << " batches, "
+                    << stats.busyNsecs.load() / 1000000 << "ms busy";
+    return debug;
+}
+
+// Starts concurrency workers that take batches from in, process them, and pass non-empty
+// results on to out. Each worker closes its side of out when it is done.
+template<typename In, typename Out, typename Process>
+QList<QFuture<void>> startStage(int concurrency,
+                                Util::BoundedQueue<In> &in,
+                                Util::BoundedQueue<Out> &out,
+                                StageStats &stats,
+                                const CancelCheck &isCanceled,
+                                const Process &process)
+{
+    QList<QFuture<void>> futures;
+    for (int i = 0; i < concurrency; ++i) {
+        futures.append(
+            QtConcurrent::run(&*sScanThreadPool, [&in, &out, &stats, isCanceled, process] {
+                In batch;
+                while (in.pop(batch, isCanceled)) {
+                    QElapsedTimer timer;
+                    timer.start();
+                    Out result = process(batch);
+                    stats.add(timer.nsecsElapsed());
+                    if (!result.empty() && !out.push(std::move(result), isCanceled))
+                        break;
+                }
+                out.producerFinished();
+            }));
+    }
+    return futures;
+}
+
+} // namespace
+
+static void listFiles(Util::BoundedQueue<QFileInfoList> &out,
+                      StageStats &stats,
+                      const QString &path,
+                      const bool recursive,
+                      const CancelCheck &isCanceled)
 {
     static const qsizetype batchSize = 200;
     QFileInfoList infos;
     infos.reserve(batchSize);
+    QElapsedTimer timer;
+    timer.start();
     const QDirListing::IteratorFlags flags = recursive
                                                  ? QDirListing::IteratorFlag::FilesOnly
                                                        | QDirListing::IteratorFlag::Recursive
@@ -275,23 +422,24 @@ static void iterateDirectory(QPromise<QFileInfoList> &promise,
     for (const QDirListing::DirEntry &entry : QDirListing(path, flags)) {
         infos << entry.fileInfo();
         if (infos.size() >= batchSize) {
-            if (topLevelPromise.isCanceled())
+            stats.add(timer.nsecsElapsed());
+            // blocks while the following stages are busy
+            if (!out.push(std::move(infos), isCanceled))
                 return;
-            // TODO should this be throttled by availability of threads in sThreadPool
-            promise.addResult(infos);
-            infos.clear();
+            infos = {};
+            infos.reserve(batchSize);
+            timer.start();
         }
     }
-    if (topLevelPromise.isCanceled())
-        return;
-    if (!infos.empty())
-        promise.addResult(infos);
+    if (!infos.empty() && !isCanceled()) {
+        stats.add(timer.nsecsElapsed());
+        out.push(std::move(infos), isCanceled);
+    }
 }
 
-static MediaItems collectItems(QPromise<MediaDirectoryModel::TopLevelResultType> &topLevelPromise,
-                               const QFileInfoList &paths,
-                               const OptionalRegExList &regexes,
-                               bool videosOnly)
+static Candidates classifyFiles(const QFileInfoList &paths,
+                                bool videosOnly,
+                                Util::SymlinkResolver &symlinkResolver)
 {
     // scraped from https://cgit.freedesktop.org/xdg/shared-mime-info/plain/freedesktop.org.xml.in
     static QList<QByteArray> videoMimeTypes = {"video/x-flv",
@@ -325,6 +473,50 @@ static MediaItems collectItems(QPromise<MediaDirectoryModel::TopLevelResultType>
                                                "video/x-sgi-movie"};
     const QList<QByteArray> supportedImages = QImageReader::supportedMimeTypes();
     const QMimeDatabase mdb;
+    Candidates candidates;
+    for (const QFileInfo &entry : paths) {
+        // the file type is known from the directory listing, so this does not stat
+        const QString resolvedFilePath = symlinkResolver.resolve(entry.filePath(),
+                                                                 entry.isSymLink());
+        const auto mimeType = mdb.mimeTypeForFile(resolvedFilePath);
+        if (mimeType.name() == "inode/directory")
+            continue;
+        // RAW files are shown with their embedded previews, which does not need an image plugin
+        if (containsMimeType(supportedImages, mimeType) || Util::isRawImage(mimeType)) {
+            if (videosOnly)
+                continue;
+            candidates.push_back({entry, resolvedFilePath, MediaType::Image});
+        } else if (containsMimeType(videoMimeTypes, mimeType)) {
+            candidates.push_back({entry, resolvedFilePath, MediaType::Video});
+        }
+    }
+    return candidates;
+}
+
+// Keeps what sorting, layout and the tag counts need, for items of incremental loading that are
+// far away from the viewport. The rest is read again when the item is materialized.
+static void dematerialize(MediaItem &item)
+{
+    Util::MetaData metaData;
+    metaData.dimensions = item.metaData.dimensions;
+    metaData.created = item.metaData.created;
+    metaData.duration = item.metaData.duration;
+    metaData.orientation = item.metaData.orientation;
+    metaData.tags = item.metaData.tags;
+    item.metaData = metaData;
+    item.thumbnail.reset();
+    item.thumbnailSize = 0;
+    item.embeddedThumbnail.reset();
+    item.compressedThumbnail.clear();
+    item.cachedToolTip.clear();
+    item.hasFullMetaData = false;
+}
+
+static MediaItems extractItems(const Candidates &candidates,
+                               const OptionalRegExList &regexes,
+                               bool incremental,
+                               const CancelCheck &isCanceled)
+{
     const auto passesFilter = [&](const QList<QString> &entries) {
         return std::all_of(regexes.cbegin(), regexes.cend(), [entries](const auto &rx) {
             return std::any_of(entries.cbegin(), entries.cend(), [rx](const QString &entry) {
@@ -332,156 +524,244 @@ static MediaItems collectItems(QPromise<MediaDirectoryModel::TopLevelResultType>
             });
         });
     };
+    QStringList resolvedFilePaths;
+    resolvedFilePaths.reserve(candidates.size());
+    for (const Candidate &candidate : candidates)
+        resolvedFilePaths.append(candidate.resolvedFilePath);
+    // one stat per file, and the header for parsing the meta data
+    const std::vector<Util::FileProbe> probes = Util::probeFiles(resolvedFilePaths,
+                                                                 Util::tagsAttributeName(),
+                                                                 kHeaderSize);
     MediaItems result;
-    for (const QFileInfo &entry : paths) {
-        if (topLevelPromise.isCanceled())
+    for (std::size_t i = 0; i < candidates.size(); ++i) {
+        if (isCanceled())
             return {};
-        const QString resolvedFilePath = Util::resolveSymlinks(entry.filePath());
-        const auto mimeType = mdb.mimeTypeForFile(resolvedFilePath);
-        if (mimeType.name() == "inode/directory")
-            continue;
-        MediaType type;
-        if (containsMimeType(supportedImages, mimeType)) {
-            if (videosOnly)
-                continue;
-            type = MediaType::Image;
-        } else if (containsMimeType(videoMimeTypes, mimeType)) {
-            type = MediaType::Video;
-        } else {
+        const Candidate &candidate = candidates.at(i);
+        const Util::FileProbe &probe = probes.at(i);
+        auto metaData = Util::metaData(candidate.resolvedFilePath, probe);
+        if (!passesFilter(metaData.tags + QList{candidate.entry.completeBaseName()}))
             continue;
+        QDateTime created;
+        QDateTime lastModified;
+        qint64 size = 0;
+        if (probe.stat) {
+            created = probe.stat->birthTime;
+            lastModified = probe.stat->lastModified;
+            size = probe.stat->size;
         }
-        QFileInfo fi(resolvedFilePath);
-        const auto metaData = Util::metaData(resolvedFilePath);
-        if (!passesFilter(metaData.tags + QList{entry.completeBaseName()}))
-            continue;
-        result.push_back(MediaItem({entry.fileName(),
-                                    entry.filePath(),
-                                    resolvedFilePath,
-                                    fi.birthTime(),
-                                    fi.lastModified(),
+        // the thumbnail is read again when the item gets close to the viewport, the rest of the
+        // meta data is dropped after it was added to the facet index
+        if (incremental)
+            metaData.thumbnail.reset();
+        result.push_back(MediaItem({candidate.entry.fileName(),
+                                    candidate.entry.filePath(),
+                                    candidate.resolvedFilePath,
+                                    created,
+                                    lastModified,
+                                    size,
                                     std::nullopt,
                                     metaData,
-                                    type}));
+                                    candidate.type,
+                                    !incremental}));
     }
     return result;
 }
 
-template<typename T>
-static void futureCont(const QFuture<T> &future,
-                       QObject *guard,
-                       const std::function<void(T)> &handleResult,
-                       const std::function<void()> &handleFinished)
-{
-    auto watcher = new QFutureWatcher<T>;
-    QObject::connect(watcher,
-                     &QFutureWatcherBase::resultReadyAt,
-                     guard,
-                     [handleResult, future](int index) { handleResult(future.resultAt(index)); });
-    QObject::connect(watcher, &QFutureWatcherBase::finished, guard, [watcher, handleFinished] {
-        handleFinished();
-        watcher->deleteLater();
-    });
-    watcher->setFuture(future);
-}
-
 void MediaDirectoryModel::load()
 {
     cancelAndWait();
     const QString path = m_path.sample();
     const bool recursive = m_isRecursive.sample();
-    const QString filterString = m_filterString.sample();
+    const std::pair<Util::FacetQuery, QString> filter = splitFilterString(m_filterString.sample());
+    const Util::FacetQuery facetQuery = filter.first;
+    const QString filterString = filter.second;
     const bool videosOnly = m_videosOnly.sample();
+    const bool incremental = m_isIncremental.sample();
     const SortKey sortKey = m_sortKey.sample();
     beginResetModel();
     m_items.clear();
+    m_itemsByResolvedPath.clear();
+    m_pendingResults.clear();
+    m_pendingThumbnails.clear();
+    m_decodingThumbnails.clear();
+    m_compressingThumbnails.clear();
+    m_decompressingThumbnails.clear();
+    m_thumbnailCosts.clear();
+    // the view reports the viewport of the new items when they are laid out
+    m_thumbnailCreator.setViewport({});
+    m_scanFilter = filterString;
+    m_facetQuery = facetQuery;
+    m_facetIndex.clear();
+    m_facetHiddenItems.clear();
+    m_isIncrementalLoad = incremental;
+    m_exposedRows = 0;
+    ++m_materializeGeneration;
+    m_pendingPages.clear();
+    m_materializedPages.clear();
+    m_materializedItems.clear();
     endResetModel();
 
     m_tags.clear();
     m_sTags.send({});
+    Util::TagStore::instance().reload();
+    Util::TagStore::instance().addDatabaseRoot(path);
 
     /*
-     * - iterate through directory (recursively or not) and collect file paths to batch size
-     * - # worker threads that check the batch size for media & collect meta data
-     * - sort results into the global result list and report back only a few times per second to
-     *   limit model updates
+     * Staged pipeline, connected by bounded queues:
+     * - list: iterate through directory (recursively or not) and collect file infos to batch size
+     * - classify: resolve symlinks and keep the batch entries that are media
+     * - extract: read stat data and meta data of the media files, apply the filter
+     * - merge (this future): sort results into the global result list and report back only a few
+     *   times per second to limit model updates, items that do not match the facet query are
+     *   reported separately
+     * The queues block producers while the following stage is busy, and each stage finishes
+     * exactly when all workers of the previous stage finished and its input is drained.
      */
-    m_futureWatcher.setFuture(
-        QtConcurrent::run([this, sortKey, path, filterString, videosOnly, recursive](
-                              QPromise<TopLevelResultType> &topLevelPromise) {
-            m_sLoadingStarted.send({});
-            const OptionalRegExList filterRegex = filterRegexFromString(filterString);
-            MediaItems results;
-            MediaItems queue;
-            const auto reportResults = [&] {
-                if (queue.empty())
-                    return;
-                const auto reportList = mergeResults(sortKey, results, queue);
-                // results = mergeResults(sortKey, results, queue);
-                queue.clear();
-                topLevelPromise.addResult(/*results*/ reportList);
-            };
-            QTimer reportTimer;
-            reportTimer.setSingleShot(false);
-            reportTimer.setInterval(200);
-            reportTimer.callOnTimeout([reportResults] { reportResults(); });
-            QEventLoop loop;
-            int runningThreads = 0;
-            const auto threadFinished = [&] {
-                --runningThreads;
-                if (runningThreads < 0)
-                    qWarning() << "!!! INTERNAL ERROR runningThreads =" << runningThreads;
-                if (runningThreads <= 0)
-                    loop.exit();
-            };
-            reportTimer.start();
-            ++runningThreads;
-            QFuture<QFileInfoList> iterateFuture = QtConcurrent::run(
-                [path, &topLevelPromise, recursive](QPromise<QFileInfoList> &promise) {
-                    iterateDirectory(promise, topLevelPromise, path, recursive);
-                });
-            futureCont<QFileInfoList>(
-                iterateFuture,
-                &loop,
-                [&](const QFileInfoList &infos) {
-                    if (topLevelPromise.isCanceled())
-                        return;
-                    ++runningThreads;
-                    QFuture<MediaItems> collectFuture = QtConcurrent::run(
-                        &*sThreadPool, [&topLevelPromise, infos, filterRegex, videosOnly] {
-                            const MediaItems items = collectItems(topLevelPromise,
-                                                                  infos,
-                                                                  filterRegex,
-                                                                  videosOnly);
-                            return items;
-                        });
-                    futureCont<MediaItems>(
-                        collectFuture,
-                        &loop,
-                        [&](const MediaItems &items) {
-                            if (!items.empty() && !topLevelPromise.isCanceled())
-                                queue.insert(queue.cend(), items.cbegin(), items.cend());
-                        },
-                        threadFinished);
-                },
-                threadFinished);
-            loop.exec();
-            reportResults();
-            m_sLoadingFinished.send({});
+    const int extractConcurrency = std::max(1, QThread::idealThreadCount() - 2);
+    // the merge stage runs in the same pool, so the scan does not take a thread of the global pool
+    sScanThreadPool->setMaxThreadCount(
+        std::max(sScanThreadPool->maxThreadCount(), 2 + kClassifyConcurrency + extractConcurrency));
+    m_futureWatcher.setFuture(QtConcurrent::run(&*sScanThreadPool,
+                                                [this,
+                                                 sortKey,
+                                                 path,
+                                                 filterString,
+                                                 facetQuery,
+                                                 videosOnly,
+                                                 incremental,
+                                                 recursive,
+                                                 extractConcurrency](
+                                                    QPromise<TopLevelResultType> &topLevelPromise) {
+        m_sLoadingStarted.send({});
+        QElapsedTimer elapsed;
+        elapsed.start();
+        const CancelCheck isCanceled = [&topLevelPromise] { return topLevelPromise.isCanceled(); };
+        const OptionalRegExList filterRegex = filterRegexFromString(filterString);
+        Util::BoundedQueue<QFileInfoList> listed(kQueueCapacity, 1);
+        Util::BoundedQueue<Candidates> classified(kQueueCapacity, kClassifyConcurrency);
+        Util::BoundedQueue<MediaItems> extracted(kQueueCapacity, extractConcurrency);
+        StageStats listStats("list");
+        StageStats classifyStats("classify");
+        StageStats extractStats("extract");
+        StageStats mergeStats("merge");
+        Util::SymlinkResolver symlinkResolver;
+
+        QList<QFuture<void>> stages;
+        stages.append(QtConcurrent::run(&*sScanThreadPool, [&, path, recursive] {
+            listFiles(listed, listStats, path, recursive, isCanceled);
+            listed.producerFinished();
         }));
+        stages += startStage(kClassifyConcurrency,
+                             listed,
+                             classified,
+                             classifyStats,
+                             isCanceled,
+                             [videosOnly, &symlinkResolver](const QFileInfoList &infos) {
+                                 return classifyFiles(infos, videosOnly, symlinkResolver);
+                             });
+        stages += startStage(extractConcurrency,
+                             classified,
+                             extracted,
+                             extractStats,
+                             isCanceled,
+                             [&filterRegex, incremental, isCanceled](const Candidates &candidates) {
+                                 return extractItems(candidates,
+                                                     filterRegex,
+                                                     incremental,
+                                                     isCanceled);
+                             });
+
+        MediaItemStore results;
+        MediaItems queue;
+        MediaItems hidden;
+        bool hasReported = false;
+        QElapsedTimer sinceReport;
+        sinceReport.start();
+        const auto reportResults = [&] {
+            sinceReport.start();
+            if (queue.empty() && hidden.empty())
+                return;
+            hasReported = true;
+            QElapsedTimer timer;
+            timer.start();
+            const auto reportList = mergeResults(sortKey, results, queue);
+            mergeStats.add(timer.nsecsElapsed());
+            topLevelPromise.addResult(ScanResult{reportList, hidden});
+            queue.clear();
+            hidden.clear();
+        };
+        MediaItems items;
+        for (;;) {
+            // blocks until the next batch, or until waiting results are due for a report
+            const bool hasWaitingResults = !queue.empty() || !hidden.empty();
+            const auto deadline = hasWaitingResults
+                                      ? std::chrono::steady_clock::now()
+                                            + std::chrono::milliseconds(
+                                                std::max(qint64(0),
+                                                         kReportInterval - sinceReport.elapsed()))
+                                      : std::chrono::steady_clock::time_point::max();
+            if (extracted.pop(items, isCanceled, deadline)) {
+                for (const MediaItem &item : items)
+                    (facetQuery.matches(item.metaData) ? queue : hidden).push_back(item);
+                // show the first items without waiting for the interval
+                if (!hasReported)
+                    reportResults();
+            } else if (isCanceled() || extracted.isDrained()) {
+                break;
+            }
+            if (sinceReport.hasExpired(kReportInterval))
+                reportResults();
+        }
+        // the stages refer to the queues and the promise
+        for (QFuture<void> &stage : stages)
+            stage.waitForFinished();
+        reportResults();
+        qCDebug(logScan) << "scanned" << path << "in" << elapsed.elapsed() << "ms"
+                         << (isCanceled() ? "(canceled)" : "");
+        qCDebug(logScan).noquote() << " " << listStats;
+        qCDebug(logScan).noquote() << " " << classifyStats;
+        qCDebug(logScan).noquote() << " " << extractStats;
+        qCDebug(logScan).noquote() << " " << mergeStats;
+        m_sLoadingFinished.send({});
+    }));
 }
 
 void MediaDirectoryModel::moveItemAtIndexToTrash(int i)
 {
     cancelAndWait();
-    if (i >= int(m_items.size()))
+    if (i < 0 || i >= int(m_items.size()))
         return;
-    const QModelIndex mIndex = index(i, 0);
-    beginRemoveRows(mIndex.parent(), mIndex.row(), mIndex.row());
-    const MediaItem &item = m_items.at(mIndex.row());
+    // the indices of pending results do not take the removal into account, so they are inserted
+    // first, which can move the item
+    const MediaItem *trashed = &m_items.at(i);
+    flushUpdates();
+    const int row = int(m_items.indexOf(trashed));
+    // in incremental mode, the inserted results can push the item out of the exposed rows
+    const bool isExposed = !m_isIncrementalLoad || row < m_exposedRows;
+    if (isExposed)
+        beginRemoveRows({}, row, row);
+    const MediaItem &item = m_items.at(row);
     const QStringList tagsToRemove = item.metaData.tags;
     Util::moveToTrash({item.filePath});
-    m_items.erase(std::begin(m_items) + mIndex.row());
-    endRemoveRows();
+    m_itemsByResolvedPath.remove(item.resolvedFilePath, const_cast<MediaItem *>(&item));
+    if (!m_itemsByResolvedPath.contains(item.resolvedFilePath))
+        m_thumbnailCosts.remove(item.resolvedFilePath);
+    m_facetIndex.remove(item.facetId);
+    if (m_isIncrementalLoad) {
+        // running materializations might refer to the removed item
+        ++m_materializeGeneration;
+        m_pendingPages.clear();
+        m_materializedPages.clear();
+        m_materializedItems.erase(std::remove(m_materializedItems.begin(),
+                                              m_materializedItems.end(),
+                                              &item),
+                                  m_materializedItems.end());
+        if (isExposed)
+            --m_exposedRows;
+    }
+    m_items.erase(row);
+    if (isExposed)
+        endRemoveRows();
 
     if (!tagsToRemove.isEmpty()) {
         for (const QString &tag : tagsToRemove)
@@ -495,6 +775,14 @@ const sodium::cell<QSet<QString>> &MediaDirectoryModel::tags() const
     return m_uniqueTags;
 }
 
+QList<Util::FacetCount> MediaDirectoryModel::facetCounts(Util::Facet facet) const
+{
+    if (m_facetQuery.isEmpty())
+        return m_facetIndex.counts(facet);
+    const std::vector<bool> matches = m_facetIndex.match(m_facetQuery);
+    return m_facetIndex.counts(facet, &matches);
+}
+
 const sodium::stream<unit> &MediaDirectoryModel::sLoadingStarted() const
 {
     return m_sLoadingStarted;
@@ -513,8 +801,12 @@ void MediaDirectoryModel::setSortKeyInternal(SortKey key)
         load();
         return;
     }
+    flushUpdates();
     beginResetModel();
     sortByKey(key, m_items);
+    m_pendingPages.clear();
+    m_materializedPages.clear();
+    ++m_materializeGeneration;
     endResetModel();
 }
 
@@ -537,7 +829,9 @@ QModelIndex MediaDirectoryModel::parent(const QModelIndex &) const
 
 int MediaDirectoryModel::rowCount(const QModelIndex &parent) const
 {
-    return parent.isValid() ? 0 : m_items.size();
+    if (parent.isValid())
+        return 0;
+    return m_isIncrementalLoad ? m_exposedRows : int(m_items.size());
 }
 
 int MediaDirectoryModel::columnCount(const QModelIndex &parent) const
@@ -571,7 +865,7 @@ static QString toolTip(const MediaItem &item)
         addEmptyRow();
         addRow(MediaDirectoryModel::tr("Original:"), item.resolvedFilePath);
     }
-    addRow(MediaDirectoryModel::tr("Size:"), sizeToString(QFileInfo(item.resolvedFilePath).size()));
+    addRow(MediaDirectoryModel::tr("Size:"), sizeToString(item.size));
     addEmptyRow();
     if (item.metaData.duration)
         addRow(MediaDirectoryModel::tr("Duration:"), durationToString(*item.metaData.duration));
@@ -583,6 +877,12 @@ static QString toolTip(const MediaItem &item)
     }
     if (item.metaData.created)
         addRow(MediaDirectoryModel::tr("Date:"), item.metaData.created->toString(format));
+    if (item.metaData.position) {
+        addRow(MediaDirectoryModel::tr("Location:"),
+               QString("%1, %2")
+                   .arg(item.metaData.position->latitude, 0, 'f', 5)
+                   .arg(item.metaData.position->longitude, 0, 'f', 5));
+    }
     addEmptyRow();
     addRow(MediaDirectoryModel::tr("Created:"), item.created.toString(format));
     addRow(MediaDirectoryModel::tr("Modified:"), item.lastModified.toString(format));
@@ -592,10 +892,21 @@ static QString toolTip(const MediaItem &item)
     return tooltip;
 }
 
+static qint64 pixmapCost(const std::optional<QPixmap> &pixmap)
+{
+    return pixmap ? qint64(pixmap->width()) * pixmap->height() * pixmap->depth() / 8 : 0;
+}
+
+static qint64 thumbnailCost(const MediaItem &item)
+{
+    return pixmapCost(item.thumbnail) + pixmapCost(item.embeddedThumbnail)
+           + item.compressedThumbnail.size();
+}
+
 QVariant MediaDirectoryModel::data(const QModelIndex &index, int role) const
 {
     if (!index.isValid() || index.column() != 0 || index.row() < 0
-        || index.row() >= m_items.size()) {
+        || index.row() >= rowCount(QModelIndex())) {
         return {};
     }
     const MediaItem &item = m_items.at(index.row());
@@ -607,11 +918,29 @@ QVariant MediaDirectoryModel::data(const QModelIndex &index, int role) const
     if (role == int(Role::Item))
         return QVariant::fromValue(item);
     if (role == int(Role::Thumbnail)) {
-        if (item.thumbnail)
+        if (m_isIncrementalLoad) {
+            // the view asks for thumbnails of the items it paints
+            const_cast<MediaDirectoryModel *>(this)->materializeAround(index.row());
+        }
+        if (item.thumbnail || item.embeddedThumbnail || !item.compressedThumbnail.isEmpty())
+            m_thumbnailCosts.set(item.resolvedFilePath, thumbnailCost(item));
+        if (item.thumbnail) {
+            // larger thumbnails are scaled down when painting, smaller ones are shown until one
+            // in the current size is created
+            if (item.thumbnailSize < m_thumbnailCreator.thumbnailSize())
+                m_thumbnailCreator.requestThumbnail(item, index.row());
             return *item.thumbnail;
-        m_thumbnailCreator.requestThumbnail(item);
+        }
+        if (item.compressedThumbnail.isEmpty()
+            || item.thumbnailSize < m_thumbnailCreator.thumbnailSize()) {
+            m_thumbnailCreator.requestThumbnail(item, index.row());
+        }
+        if (!item.compressedThumbnail.isEmpty())
+            const_cast<MediaDirectoryModel *>(this)->decodeCompressedThumbnail(item);
+        if (item.embeddedThumbnail)
+            return *item.embeddedThumbnail;
         if (item.metaData.thumbnail)
-            return *item.metaData.thumbnail;
+            const_cast<MediaDirectoryModel *>(this)->decodeEmbeddedThumbnail(item);
         return {};
     }
     if (role == int(Role::ShowDateDisplay))
@@ -624,24 +953,447 @@ QVariant MediaDirectoryModel::data(const QModelIndex &index, int role) const
         }
         return {};
     }
-    if (role == Qt::ToolTipRole)
-        return toolTip(item);
+    if (role == Qt::ToolTipRole) {
+        if (item.cachedToolTip.isEmpty())
+            item.cachedToolTip = toolTip(item);
+        return item.cachedToolTip;
+    }
     return {};
 }
 
+bool MediaDirectoryModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && m_isIncrementalLoad && m_exposedRows < int(m_items.size());
+}
+
+void MediaDirectoryModel::fetchMore(const QModelIndex &parent)
+{
+    if (!parent.isValid() && m_isIncrementalLoad)
+        exposeRows(kPageSize);
+}
+
+void MediaDirectoryModel::exposeRows(int count)
+{
+    count = std::min(count, int(m_items.size()) - m_exposedRows);
+    if (count <= 0)
+        return;
+    beginInsertRows(QModelIndex(), m_exposedRows, m_exposedRows + count - 1);
+    m_exposedRows += count;
+    endInsertRows();
+}
+
+// reads the full meta data for the pages around row, and drops it for pages far away
+void MediaDirectoryModel::materializeAround(int row)
+{
+    m_lastRequestedRow = row;
+    const int page = row / kPageSize;
+    for (int p = std::max(0, page - 1); p <= page + 1; ++p) {
+        if (m_pendingPages.count(p) > 0 || m_materializedPages.count(p) > 0)
+            continue;
+        const int first = p * kPageSize;
+        const int last = std::min(int(m_items.size()), first + kPageSize);
+        std::vector<MediaItem *> items;
+        QStringList filePaths;
+        auto it = m_items.iteratorAt(first);
+        for (int i = first; i < last; ++i, ++it) {
+            if (!it->hasFullMetaData) {
+                items.push_back(&*it);
+                filePaths.append(it->resolvedFilePath);
+            }
+        }
+        if (items.empty()) {
+            m_materializedPages.insert(p);
+            continue;
+        }
+        m_pendingPages.insert(p);
+        const int generation = m_materializeGeneration;
+        QtConcurrent::run(&*sThreadPool,
+                          [filePaths] {
+                              // the same native parsers and single header read as the scan
+                              const std::vector<Util::FileProbe> probes
+                                  = Util::probeFiles(filePaths,
+                                                     Util::tagsAttributeName(),
+                                                     kHeaderSize);
+                              std::vector<Util::MetaData> result;
+                              result.reserve(filePaths.size());
+                              for (qsizetype i = 0; i < filePaths.size(); ++i)
+                                  result.push_back(Util::metaData(filePaths.at(i), probes.at(i)));
+                              return result;
+                          })
+            .then(this,
+                  [this, p, generation, items](const std::vector<Util::MetaData> &metaData) {
+                      if (generation != m_materializeGeneration)
+                          return;
+                      m_pendingPages.erase(p);
+                      int firstRow = std::numeric_limits<int>::max();
+                      int lastRow = -1;
+                      for (std::size_t i = 0; i < items.size(); ++i) {
+                          MediaItem *item = items.at(i);
+                          if (item->hasFullMetaData)
+                              continue;
+                          // the tags are counted, and changed through the model in the meantime
+                          const QList<QString> tags = item->metaData.tags;
+                          item->metaData = metaData.at(i);
+                          item->metaData.tags = tags;
+                          item->cachedToolTip.clear();
+                          item->hasFullMetaData = true;
+                          m_materializedItems.push_back(item);
+                          const int itemRow = int(m_items.indexOf(item));
+                          firstRow = std::min(firstRow, itemRow);
+                          lastRow = std::max(lastRow, itemRow);
+                      }
+                      lastRow = std::min(lastRow, m_exposedRows - 1);
+                      if (firstRow <= lastRow)
+                          emit dataChanged(index(firstRow, 0),
+                                           index(lastRow, 0),
+                                           {int(Role::Thumbnail)});
+                      evictMaterialized();
+                  });
+    }
+}
+
+void MediaDirectoryModel::evictMaterialized()
+{
+    if (m_materializedItems.size() <= kMaxMaterializedItems)
+        return;
+    std::vector<MediaItem *> kept;
+    for (MediaItem *item : m_materializedItems) {
+        const int row = int(m_items.indexOf(item));
+        if (std::abs(row - m_lastRequestedRow) > kMaterializeDistance) {
+            dematerialize(*item);
+            m_thumbnailCosts.remove(item->resolvedFilePath);
+        } else {
+            kept.push_back(item);
+        }
+    }
+    if (kept.size() != m_materializedItems.size())
+        m_materializedPages.clear();
+    m_materializedItems = kept;
+}
+
+void MediaDirectoryModel::flushUpdates()
+{
+    // the model signals of all inserts end up in a single delayed layout of the view
+    for (const ScanResult &result : m_pendingResults) {
+        for (const auto &value : result.inserts)
+            insertItems(value.first, value.second);
+        hideItems(result.hidden);
+    }
+    m_pendingResults.clear();
+    applyThumbnails();
+}
+
+// whether the thumbnail changes the size hint of the item
+static bool changesLayout(const MediaItem &item, const QPixmap &pixmap)
+{
+    const std::optional<QSize> previous = item.thumbnail ? item.thumbnail->size()
+                                                         : item.metaData.dimensions;
+    if (!previous || previous->isEmpty() || pixmap.isNull())
+        return true;
+    const qreal previousRatio = qreal(previous->width()) / previous->height();
+    const qreal ratio = qreal(pixmap.width()) / pixmap.height();
+    return qAbs(previousRatio - ratio) > 0.01;
+}
+
+void MediaDirectoryModel::applyThumbnails()
+{
+    if (m_pendingThumbnails.isEmpty())
+        return;
+    bool needsLayout = false;
+    int firstRow = std::numeric_limits<int>::max();
+    int lastRow = -1;
+    const int rows = rowCount(QModelIndex());
+    for (auto it = m_pendingThumbnails.cbegin(); it != m_pendingThumbnails.cend(); ++it) {
+        const auto items = m_itemsByResolvedPath.values(it.key());
+        for (MediaItem *item : items) {
+            if (it->isEmbedded && item->thumbnail)
+                continue;
+            // finished after a larger one, because the view got larger in the meantime
+            if (!it->isEmbedded && item->thumbnail && item->thumbnailSize > it->size)
+                continue;
+            const int row = int(m_items.indexOf(item));
+            if (row < rows) {
+                // embedded thumbnails are cut to the aspect ratio of the image
+                needsLayout = needsLayout || (!it->isEmbedded && changesLayout(*item, it->pixmap));
+                firstRow = std::min(firstRow, row);
+                lastRow = std::max(lastRow, row);
+            }
+            if (it->isEmbedded) {
+                item->embeddedThumbnail = it->pixmap;
+            } else {
+                // pixmaps that were decoded from the compressed thumbnail have its size
+                if (item->thumbnailSize != it->size)
+                    item->compressedThumbnail.clear();
+                item->thumbnail = it->pixmap;
+                item->thumbnailSize = it->size;
+                if (it->duration) {
+                    item->metaData.duration = it->duration;
+                    item->cachedToolTip.clear();
+                }
+            }
+        }
+        if (!items.isEmpty())
+            m_thumbnailCosts.set(it.key(), thumbnailCost(*items.first()));
+    }
+    m_pendingThumbnails.clear();
+    evictThumbnails();
+    if (lastRow < 0)
+        return;
+    if (needsLayout) {
+        emit layoutAboutToBeChanged();
+        emit layoutChanged();
+    } else {
+        emit dataChanged(index(firstRow, 0), index(lastRow, 0), {int(Role::Thumbnail)});
+    }
+}
+
+// Drops the least recently shown thumbnails until they fit into the budget again. Thumbnails of
+// the viewport and as many rows before and after it are kept. Pixmaps are compressed and dropped
+// first, the compressed thumbnails are decoded again when the view shows the items. Items that
+// have neither get their thumbnails created again.
+void MediaDirectoryModel::evictThumbnails()
+{
+    qint64 total = m_thumbnailCosts.totalCost();
+    if (total <= m_thumbnailBudget)
+        return;
+    const ThumbnailCreator::Viewport viewport = m_thumbnailCreator.viewport();
+    const int margin = std::max(0, viewport.lastRow - viewport.firstRow + 1);
+    const auto isNearViewport = [this, &viewport, margin](const QList<MediaItem *> &items) {
+        return std::any_of(items.cbegin(), items.cend(), [&](MediaItem *item) {
+            const int row = int(m_items.indexOf(item));
+            return row >= viewport.firstRow - margin && row <= viewport.lastRow + margin;
+        });
+    };
+    int compressed = 0;
+    for (const QString &resolvedFilePath : m_thumbnailCosts) {
+        if (total <= m_thumbnailBudget)
+            break;
+        const auto items = m_itemsByResolvedPath.values(resolvedFilePath);
+        // the empty thumbnails of failed items are not created again
+        if (items.isEmpty() || m_thumbnailCosts.cost(resolvedFilePath) == 0
+            || (!items.first()->thumbnail && !items.first()->embeddedThumbnail)
+            || isNearViewport(items)) {
+            continue;
+        }
+        const MediaItem *first = items.first();
+        if (first->thumbnail && first->compressedThumbnail.isEmpty())
+            compressThumbnail(resolvedFilePath, first->thumbnail->toImage(), first->thumbnailSize);
+        for (MediaItem *item : items) {
+            // keeps metaData.thumbnail, so the embedded thumbnail can be decoded again
+            item->thumbnail.reset();
+            item->embeddedThumbnail.reset();
+        }
+        const qint64 cost = thumbnailCost(*first);
+        total -= m_thumbnailCosts.cost(resolvedFilePath) - cost;
+        m_thumbnailCosts.update(resolvedFilePath, cost);
+        ++compressed;
+    }
+    std::vector<QString> evicted;
+    for (const QString &resolvedFilePath : m_thumbnailCosts) {
+        if (total <= m_thumbnailBudget)
+            break;
+        const auto items = m_itemsByResolvedPath.values(resolvedFilePath);
+        if (m_compressingThumbnails.contains(resolvedFilePath)
+            || (!items.isEmpty() && m_thumbnailCosts.cost(resolvedFilePath) == 0)
+            || isNearViewport(items)) {
+            continue;
+        }
+        for (MediaItem *item : items) {
+            item->thumbnail.reset();
+            item->thumbnailSize = 0;
+            item->embeddedThumbnail.reset();
+            item->compressedThumbnail.clear();
+        }
+        total -= m_thumbnailCosts.cost(resolvedFilePath);
+        evicted.push_back(resolvedFilePath);
+    }
+    for (const QString &resolvedFilePath : evicted)
+        m_thumbnailCosts.remove(resolvedFilePath);
+    qCDebug(logScan) << "compressed" << compressed << "and evicted" << evicted.size()
+                     << "thumbnails, using" << m_thumbnailCosts.totalCost() / (1024 * 1024)
+                     << "MB";
+}
+
+void MediaDirectoryModel::setRequiredThumbnailSize(int size)
+{
+    if (!m_thumbnailCreator.setRequiredSize(size))
+        return;
+    // the view asks for thumbnails of the visible items again, which requests the new size
+    const int rows = rowCount(QModelIndex());
+    if (rows > 0)
+        emit dataChanged(index(0, 0), index(rows - 1, 0), {int(Role::Thumbnail)});
+}
+
+void MediaDirectoryModel::setViewport(int firstRow,
+                                      int lastRow,
+                                      int direction,
+                                      bool isScrollingFast)
+{
+    m_thumbnailCreator.setViewport({firstRow, lastRow, direction, isScrollingFast});
+    if (isScrollingFast || lastRow < firstRow)
+        return;
+    // prefetch as many items as are visible in the scroll direction, or half of that on both
+    // sides when not scrolling
+    const int count = lastRow - firstRow + 1;
+    const int rows = rowCount(QModelIndex());
+    const auto prefetch = [this, rows](int from, int to) {
+        for (int row = std::max(0, from); row <= std::min(rows - 1, to); ++row) {
+            const MediaItem &item = m_items.at(row);
+            // the orientation is not known before the item is materialized
+            if (!item.hasFullMetaData)
+                continue;
+            if (!item.thumbnail && !item.compressedThumbnail.isEmpty())
+                decodeCompressedThumbnail(item);
+            if ((!item.thumbnail && item.compressedThumbnail.isEmpty())
+                || item.thumbnailSize < m_thumbnailCreator.thumbnailSize()) {
+                m_thumbnailCreator.requestThumbnail(item, row);
+            }
+        }
+    };
+    if (direction >= 0)
+        prefetch(lastRow + 1, lastRow + (direction > 0 ? count : count / 2));
+    if (direction <= 0)
+        prefetch(firstRow - (direction < 0 ? count : count / 2), firstRow - 1);
+}
+
+// decodes the embedded thumbnail in a worker thread and shows it with the next update
+void MediaDirectoryModel::decodeEmbeddedThumbnail(const MediaItem &item)
+{
+    const QString resolvedFilePath = item.resolvedFilePath;
+    if (m_decodingThumbnails.contains(resolvedFilePath))
+        return;
+    m_decodingThumbnails.insert(resolvedFilePath);
+    const Util::MetaData metaData = item.metaData;
+    QtConcurrent::run(&*sThreadPool,
+                      [resolvedFilePath, metaData] {
+                          return Util::embeddedThumbnail(resolvedFilePath, metaData);
+                      })
+        .then(this, [this, resolvedFilePath](const QImage &image) {
+            if (!m_decodingThumbnails.remove(resolvedFilePath))
+                return; // reloaded in the meantime
+            if (image.isNull()) {
+                // do not try again
+                const auto items = m_itemsByResolvedPath.values(resolvedFilePath);
+                for (MediaItem *item : items)
+                    item->metaData.thumbnail.reset();
+                return;
+            }
+            if (m_pendingThumbnails.contains(resolvedFilePath))
+                return;
+            m_pendingThumbnails.insert(resolvedFilePath,
+                                       {QPixmap::fromImage(image), std::nullopt, true});
+            m_updateScheduler.request();
+        });
+}
+
+// compresses the thumbnail in a worker thread, so it can be kept when the pixmap is dropped
+void MediaDirectoryModel::compressThumbnail(const QString &resolvedFilePath,
+                                            const QImage &image,
+                                            int size)
+{
+    if (image.isNull() || m_compressingThumbnails.contains(resolvedFilePath))
+        return;
+    m_compressingThumbnails.insert(resolvedFilePath);
+    QtConcurrent::run(&*sThreadPool,
+                      [image] {
+                          QByteArray data;
+                          QBuffer buffer(&data);
+                          buffer.open(QIODevice::WriteOnly);
+                          // JPEG is always available, PNG keeps transparency
+                          if (image.hasAlphaChannel())
+                              image.save(&buffer, "PNG");
+                          else
+                              image.save(&buffer, "JPG", kCompressedThumbnailQuality);
+                          return data;
+                      })
+        .then(this, [this, resolvedFilePath, size](const QByteArray &data) {
+            if (!m_compressingThumbnails.remove(resolvedFilePath))
+                return; // reloaded in the meantime
+            // not tracked anymore, because the items were evicted or removed
+            if (!m_thumbnailCosts.contains(resolvedFilePath))
+                return;
+            const auto items = m_itemsByResolvedPath.values(resolvedFilePath);
+            for (MediaItem *item : items) {
+                // a thumbnail in a different size was created in the meantime
+                if (item->thumbnailSize == size)
+                    item->compressedThumbnail = data;
+            }
+            if (!items.isEmpty())
+                m_thumbnailCosts.update(resolvedFilePath, thumbnailCost(*items.first()));
+        });
+}
+
+// decodes the compressed thumbnail in a worker thread and shows it with the next update
+void MediaDirectoryModel::decodeCompressedThumbnail(const MediaItem &item)
+{
+    const QString resolvedFilePath = item.resolvedFilePath;
+    if (m_decompressingThumbnails.contains(resolvedFilePath))
+        return;
+    m_decompressingThumbnails.insert(resolvedFilePath);
+    const QByteArray data = item.compressedThumbnail;
+    const int size = item.thumbnailSize;
+    QtConcurrent::run(&*sThreadPool, [data] { return QImage::fromData(data); })
+        .then(this, [this, resolvedFilePath, size](const QImage &image) {
+            if (!m_decompressingThumbnails.remove(resolvedFilePath))
+                return; // reloaded in the meantime
+            if (image.isNull()) {
+                // create the thumbnail again instead
+                const auto items = m_itemsByResolvedPath.values(resolvedFilePath);
+                for (MediaItem *item : items)
+                    item->compressedThumbnail.clear();
+                return;
+            }
+            if (m_pendingThumbnails.contains(resolvedFilePath))
+                return;
+            m_pendingThumbnails.insert(resolvedFilePath,
+                                       {QPixmap::fromImage(image), std::nullopt, false, size});
+            m_updateScheduler.request();
+        });
+}
+
 void MediaDirectoryModel::insertItems(int index, const MediaItems &items)
 {
     if (items.empty() || index > m_items.size())
         return;
-    if (m_items.empty()) {
+    if (m_isIncrementalLoad) {
+        const int count = int(items.size());
+        const int previouslyExposed = m_exposedRows;
+        if (index < m_exposedRows || (index == m_exposedRows && m_exposedRows < kPageSize)) {
+            beginInsertRows(QModelIndex(), index, index + count - 1);
+            m_items.insert(index, std::begin(items), std::end(items));
+            m_exposedRows += count;
+            endInsertRows();
+            // keep the number of exposed rows, the ones pushed out can be fetched again
+            const int excess = m_exposedRows - std::max(previouslyExposed, kPageSize);
+            if (excess > 0) {
+                beginRemoveRows(QModelIndex(), m_exposedRows - excess, m_exposedRows - 1);
+                m_exposedRows -= excess;
+                endRemoveRows();
+            }
+        } else {
+            m_items.insert(index, std::begin(items), std::end(items));
+        }
+        if (m_exposedRows < kPageSize)
+            exposeRows(kPageSize - m_exposedRows);
+    } else if (m_items.empty()) {
         beginResetModel();
-        m_items = items;
+        m_items.assign(std::begin(items), std::end(items));
         endResetModel();
     } else {
         beginInsertRows(QModelIndex(), index, index + items.size() - 1);
-        m_items.insert(std::begin(m_items) + index, std::begin(items), std::end(items));
+        m_items.insert(index, std::begin(items), std::end(items));
         endInsertRows();
     }
+    // the inserted items move the following ones into other pages
+    m_materializedPages.erase(m_materializedPages.lower_bound(index / kPageSize),
+                              m_materializedPages.end());
+    auto it = m_items.iteratorAt(index);
+    for (std::size_t i = 0; i < items.size(); ++i, ++it) {
+        m_itemsByResolvedPath.insert(it->resolvedFilePath, &*it);
+        it->facetId = m_facetIndex.add(it->metaData);
+        if (!it->hasFullMetaData)
+            dematerialize(*it);
+    }
 
     const int tagsSize = m_tags.size();
     for (const MediaItem &item : items)
@@ -650,6 +1402,69 @@ void MediaDirectoryModel::insertItems(int index, const MediaItems &items)
         m_sTags.send(m_tags);
 }
 
+// items that do not match the facet query, they are kept for when the query changes
+void MediaDirectoryModel::hideItems(const MediaItems &items)
+{
+    if (items.empty())
+        return;
+    const int tagsSize = m_tags.size();
+    for (const MediaItem &item : items) {
+        m_facetHiddenItems.push_back(item);
+        m_facetHiddenItems.back().facetId = m_facetIndex.add(item.metaData);
+        if (!item.hasFullMetaData)
+            dematerialize(m_facetHiddenItems.back());
+        m_tags += item.metaData.tags;
+    }
+    if (m_tags.size() != tagsSize)
+        m_sTags.send(m_tags);
+}
+
+void MediaDirectoryModel::setFacetQuery(const Util::FacetQuery &query)
+{
+    if (query == m_facetQuery)
+        return;
+    flushUpdates();
+    m_facetQuery = query;
+    const std::vector<bool> matches = m_facetIndex.match(query);
+    MediaItems visible;
+    MediaItems hidden;
+    for (const MediaItem &item : m_items)
+        (matches.at(item.facetId) ? visible : hidden).push_back(item);
+    const std::size_t keptCount = visible.size();
+    for (const MediaItem &item : m_facetHiddenItems)
+        (matches.at(item.facetId) ? visible : hidden).push_back(item);
+    // the items that were visible before are sorted already
+    if (visible.size() > keptCount)
+        sortByKey(m_sortKey.sample(), visible);
+
+    beginResetModel();
+    m_items.assign(visible.begin(), visible.end());
+    m_facetHiddenItems = hidden;
+    m_itemsByResolvedPath.clear();
+    m_thumbnailCreator.setViewport({});
+    ++m_materializeGeneration;
+    m_pendingPages.clear();
+    m_materializedPages.clear();
+    m_materializedItems.clear();
+    for (MediaItem &item : m_items) {
+        m_itemsByResolvedPath.insert(item.resolvedFilePath, &item);
+        if (m_isIncrementalLoad && item.hasFullMetaData)
+            m_materializedItems.push_back(&item);
+    }
+    // hidden items are not shown, so their thumbnails are not kept within the budget
+    for (MediaItem &item : m_facetHiddenItems) {
+        item.thumbnail.reset();
+        item.thumbnailSize = 0;
+        item.embeddedThumbnail.reset();
+        item.compressedThumbnail.clear();
+        if (!m_itemsByResolvedPath.contains(item.resolvedFilePath))
+            m_thumbnailCosts.remove(item.resolvedFilePath);
+    }
+    if (m_isIncrementalLoad)
+        m_exposedRows = std::min(int(m_items.size()), kPageSize);
+    endResetModel();
+}
+
 void MediaDirectoryModel::cancelAndWait()
 {
     m_futureWatcher.cancel();
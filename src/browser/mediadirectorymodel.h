@@ -1,18 +1,26 @@
 #pragma once
 
+#include "framescheduler.h"
 #include "thumbnailcreator.h"
 
 #include <sqtools.h>
 
+#include <util/chunkedsequence.h>
+#include <util/facetindex.h>
+#include <util/lrucosts.h>
 #include <util/metadatautil.h>
 
 #include <QAbstractItemModel>
 #include <QDateTime>
 #include <QFutureWatcher>
+#include <QMultiHash>
+#include <QPixmap>
 
 #include <sodium/sodium.h>
 
 #include <optional>
+#include <set>
+#include <unordered_set>
 
 enum class MediaType { Image, Video };
 
@@ -24,16 +32,29 @@ public:
     QString resolvedFilePath;
     QDateTime created;
     QDateTime lastModified;
+    qint64 size = 0;
     std::optional<QPixmap> thumbnail;
     Util::MetaData metaData;
     MediaType type;
+    // false for items of incremental loading that only have the data needed for sorting and layout
+    bool hasFullMetaData = true;
+    // the size that the thumbnail was created for, see ThumbnailCreator::thumbnailSize
+    int thumbnailSize = 0;
+    // decoded from metaData.thumbnail, shown until the thumbnail is created
+    std::optional<QPixmap> embeddedThumbnail;
+    // the thumbnail in thumbnailSize as JPEG or PNG, kept when the pixmap is dropped to save memory
+    QByteArray compressedThumbnail;
+    Util::FacetIndex::Id facetId = 0;
 
     mutable QDateTime cachedCreatedDateTime;
     const QDateTime &createdDateTime() const;
+    // built when first needed, must be cleared when the data shown in it changes
+    mutable QString cachedToolTip;
     QString windowTitle() const;
 };
 
 using MediaItems = std::vector<MediaItem>;
+using MediaItemStore = Util::ChunkedSequence<MediaItem>;
 using OptionalMediaItem = std::optional<MediaItem>;
 bool isMediaItem(const OptionalMediaItem &item);
 Q_DECLARE_METATYPE(MediaItem)
@@ -57,6 +78,7 @@ public:
     void setSortKey(const sodium::cell<SortKey> &sortKey);
     void setFilterString(const sodium::cell<QString> &filterString);
     void setVideosOnly(const sodium::cell<bool> &videosOnly);
+    void setIncrementalLoading(const sodium::cell<bool> &incremental);
 
     void setToggleTag(const sodium::stream<std::pair<OptionalMediaItem, QString>> &sToggleTag);
 
@@ -67,7 +89,14 @@ public:
 
     void moveItemAtIndexToTrash(int index);
 
+    // longer side of thumbnails in device pixels that the view needs
+    void setRequiredThumbnailSize(int size);
+    // the rows that the view shows, and how it scrolls, for prioritizing thumbnails
+    void setViewport(int firstRow, int lastRow, int direction, bool isScrollingFast);
+
     const sodium::cell<QSet<QString>> &tags() const;
+    // number of loaded items per value of the facet, among the items that pass the filter
+    QList<Util::FacetCount> facetCounts(Util::Facet facet) const;
 
 public:
     QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
@@ -75,18 +104,70 @@ public:
     int rowCount(const QModelIndex &parent) const override;
     int columnCount(const QModelIndex &parent) const override;
     QVariant data(const QModelIndex &index, int role) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
 
     using ResultList = std::vector<std::pair<MediaItems::size_type, MediaItems>>;
-    using TopLevelResultType = MediaDirectoryModel::ResultList;
+    // sorted insertions, and the items that do not match the facet query
+    class ScanResult
+    {
+    public:
+        ResultList inserts;
+        MediaItems hidden;
+    };
+    using TopLevelResultType = ScanResult;
 
 private:
     void load();
     void setSortKeyInternal(SortKey key);
+    void flushUpdates();
+    void applyThumbnails();
+    void evictThumbnails();
+    void decodeEmbeddedThumbnail(const MediaItem &item);
+    void compressThumbnail(const QString &resolvedFilePath, const QImage &image, int size);
+    void decodeCompressedThumbnail(const MediaItem &item);
     void insertItems(int index, const MediaItems &items);
+    void hideItems(const MediaItems &items);
+    void setFacetQuery(const Util::FacetQuery &query);
+    void exposeRows(int count);
+    void materializeAround(int row);
+    void evictMaterialized();
     void cancelAndWait();
     void setupDateDisplay();
 
-    MediaItems m_items;
+    MediaItemStore m_items;
+    // incremental loading only exposes the first m_exposedRows items to views
+    bool m_isIncrementalLoad = false;
+    int m_exposedRows = 0;
+    int m_materializeGeneration = 0;
+    int m_lastRequestedRow = 0;
+    std::unordered_set<int> m_pendingPages;
+    // pages without items that still need to be materialized
+    std::set<int> m_materializedPages;
+    std::vector<MediaItem *> m_materializedItems;
+    QMultiHash<QString, MediaItem *> m_itemsByResolvedPath;
+    // scan results and thumbnails are applied at most once per frame
+    struct PendingThumbnail
+    {
+        QPixmap pixmap;
+        std::optional<qint64> duration;
+        bool isEmbedded = false;
+        int size = 0;
+    };
+    FrameScheduler m_updateScheduler;
+    std::vector<ScanResult> m_pendingResults;
+    QHash<QString, PendingThumbnail> m_pendingThumbnails;
+    QSet<QString> m_decodingThumbnails;
+    QSet<QString> m_compressingThumbnails;
+    QSet<QString> m_decompressingThumbnails;
+    // memory of the thumbnails per resolved path, in the order they were last shown
+    mutable Util::LruCosts<QString> m_thumbnailCosts;
+    const qint64 m_thumbnailBudget;
+    // facet conditions of the filter are applied to the loaded items without scanning again
+    QString m_scanFilter;
+    Util::FacetQuery m_facetQuery;
+    Util::FacetIndex m_facetIndex;
+    MediaItems m_facetHiddenItems;
     QStringList m_tags; // including duplicates so we can keep count when removing
     QFutureWatcher<TopLevelResultType> m_futureWatcher;
     mutable ThumbnailCreator m_thumbnailCreator;
@@ -94,6 +175,7 @@ private:
     sodium::cell<bool> m_isRecursive;
     sodium::cell<QString> m_filterString;
     sodium::cell<bool> m_videosOnly;
+    sodium::cell<bool> m_isIncremental;
     sodium::cell<SortKey> m_sortKey;
     sodium::cell<bool> m_showDateDisplay;
     sodium::stream_sink<QStringList> m_sTags;
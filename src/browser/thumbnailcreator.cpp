@@ -2,19 +2,33 @@
 
 #include "mediadirectorymodel.h"
 
+#include <util/bmffparser.h>
+#include <util/downscale.h>
+
 #include <QImageReader>
 #include <QLoggingCategory>
 #include <QMediaPlayer>
+#include <QThread>
 #include <QTimer>
 #include <QUrl>
 #include <QVideoFrame>
 #include <QVideoSink>
 #include <QtConcurrent>
 
+#include <functional>
+#include <limits>
+#include <utility>
+
 Q_LOGGING_CATEGORY(logThumb, "browser.thumbnails", QtWarningMsg)
-const int THUMBNAIL_SIZE = 400;
+// size tiers, so resizing the view only needs new thumbnails when it crosses a tier
+const int THUMBNAIL_SIZES[] = {256, 400, 640, 1024, 1600, 2560};
+const int DEFAULT_THUMBNAIL_SIZE = 400;
 const int MAX_PICTURE_THUMB_THREADS = 4;
-const int MAX_PENDING = 40;
+const int MAX_VIDEO_THUMB_WORKERS = 4;
+const int VIDEO_THUMB_TIMEOUT_MS = 10000;
+const int MAX_PENDING = 100;
+// items that are further away from the viewport than this many viewport widths are dropped
+const int CANCEL_DISTANCE = 3;
 
 namespace {
 
@@ -27,12 +41,16 @@ public:
 
 QImage restrictImageToSize(const QImage &image, int maxSize)
 {
-    if (image.width() > maxSize || image.height() > maxSize) {
-        if (image.width() > image.height())
-            return image.scaledToWidth(maxSize, Qt::SmoothTransformation);
-        return image.scaledToHeight(maxSize, Qt::SmoothTransformation);
-    }
-    return image;
+    return Util::downscaled(image, {maxSize, maxSize});
+}
+
+// Size that fits into maxSize x maxSize. Rotating by multiples of 90 degrees does not change
+// the longer side, so this can be computed before applying the orientation.
+static QSize restrictSize(const QSize &size, int maxSize)
+{
+    if (size.width() <= maxSize && size.height() <= maxSize)
+        return size;
+    return size.scaled(maxSize, maxSize, Qt::KeepAspectRatio);
 }
 
 void createThumbnailImage(QPromise<QImage> &fi,
@@ -40,17 +58,38 @@ void createThumbnailImage(QPromise<QImage> &fi,
                           const Util::Orientation orientation,
                           const int maxSize)
 {
-    QImage image(filePath);
+    // camera files often embed previews that are large enough, which avoids decoding the image
+    if (Util::hasEmbeddedPreviews(filePath)) {
+        // RAW data is never decoded, a smaller preview is better than nothing
+        const bool isRaw = Util::isRawImage(filePath);
+        const QImage preview = Util::embeddedPreview(filePath, maxSize, isRaw);
+        if (fi.isCanceled())
+            return;
+        if (!preview.isNull() || isRaw) {
+            fi.addResult(preview);
+            return;
+        }
+    }
+    // let the decoder produce the reduced size directly, which for JPEG uses DCT scaling and
+    // avoids allocating and rotating the full resolution image
+    QImageReader reader(filePath);
+    reader.setAutoTransform(false);
+    const QSize size = reader.size();
+    if (size.isValid())
+        reader.setScaledSize(restrictSize(size, maxSize));
+    QImage image = reader.read();
     if (fi.isCanceled())
         return;
     if (image.isNull()) {
         fi.addResult(image);
         return;
     }
-    image = image.transformed(Util::matrixForOrientation(image.size(), orientation).toTransform());
+    // decoders that do not support scaled reading return the full size
+    image = restrictImageToSize(image, maxSize);
     if (fi.isCanceled())
         return;
-    fi.addResult(restrictImageToSize(image, maxSize));
+    fi.addResult(
+        image.transformed(Util::matrixForOrientation(image.size(), orientation).toTransform()));
 }
 
 class PictureThumbnailer : public Thumbnailer
@@ -64,6 +103,7 @@ public:
     void cancel(const QString &resolvedFilePath) override;
     void requestThumbnail(const QString &resolvedFilePath,
                           Util::Orientation orientation,
+                          std::optional<qint64> duration,
                           const int maxSize) override;
 
 private:
@@ -106,13 +146,15 @@ void PictureThumbnailer::cancel(const QString &resolvedFilePath)
 
 void PictureThumbnailer::requestThumbnail(const QString &resolvedFilePath,
                                           Util::Orientation orientation,
+                                          std::optional<qint64> duration,
                                           const int maxSize)
 {
+    Q_UNUSED(duration)
     qDebug(logThumb) << "starting" << resolvedFilePath;
     auto future = QtConcurrent::run(createThumbnailImage, resolvedFilePath, orientation, maxSize);
     m_running.emplace_back(resolvedFilePath, future);
     future.then(this,
-                [this, resolvedFilePath](const QFuture<QImage> &future) {
+                [this, resolvedFilePath, maxSize](const QFuture<QImage> &future) {
                     auto runningItem = std::find_if(m_running.begin(),
                                                     m_running.end(),
                                                     [resolvedFilePath](const RunningItem &item) {
@@ -126,70 +168,200 @@ void PictureThumbnailer::requestThumbnail(const QString &resolvedFilePath,
                     if (!future.isCanceled() && future.resultCount() > 0) {
                         qDebug(logThumb) << "finished" << resolvedFilePath;
                         const auto result = future.result();
-                        emit thumbnailReady(resolvedFilePath, result, std::nullopt);
+                        emit thumbnailReady(resolvedFilePath, result, maxSize, std::nullopt);
                     }
                 });
 }
 
-static void createVideoThumbnail(QPromise<ThumbnailItem> &fi,
-                                 const QString &resolvedFilePath,
-                                 const int maxSize)
+// Creates video thumbnails from embedded images, or with a media player that is reused for all
+// items, in its own thread.
+class VideoWorker : public QObject
+{
+public:
+    // called in the worker thread, the image is null if the thumbnail could not be created
+    using Done = std::function<void(const QString &resolvedFilePath, const ThumbnailItem &item)>;
+
+    explicit VideoWorker(const Done &done);
+
+    // must be called in the worker thread
+    void start(const QString &resolvedFilePath, std::optional<qint64> duration, int maxSize);
+    void cancel();
+
+private:
+    void createPlayer();
+    void finish(const QImage &image);
+
+    Done m_done;
+    QMediaPlayer *m_player = nullptr;
+    QVideoSink *m_sink = nullptr;
+    QTimer *m_timeout = nullptr;
+    QString m_resolvedFilePath;
+    qint64 m_duration = 0;
+    int m_maxSize = 0;
+    // an embedded image that is too small, used if the player cannot create a frame
+    QImage m_embeddedImage;
+};
+
+VideoWorker::VideoWorker(const Done &done)
+    : m_done(done)
+{}
+
+void VideoWorker::createPlayer()
+{
+    m_player = new QMediaPlayer(this);
+    m_sink = new QVideoSink(this);
+    m_player->setVideoSink(m_sink);
+    m_timeout = new QTimer(this);
+    m_timeout->setSingleShot(true);
+    m_timeout->setInterval(VIDEO_THUMB_TIMEOUT_MS);
+    connect(m_timeout, &QTimer::timeout, this, [this] {
+        qCDebug(logThumb) << "timeout while creating thumbnail for" << m_resolvedFilePath;
+        finish({});
+    });
+    connect(m_player,
+            &QMediaPlayer::playbackStateChanged,
+            this,
+            [this](QMediaPlayer::PlaybackState state) {
+                // without a known duration the player has to play until it knows it
+                if (state == QMediaPlayer::PlayingState && m_duration <= 0) {
+                    m_duration = m_player->duration();
+                    m_player->setPosition(m_duration * 3 / 100);
+                }
+            });
+    connect(m_sink, &QVideoSink::videoFrameChanged, this, [this](const QVideoFrame &frame) {
+        if (!m_resolvedFilePath.isEmpty() && frame.isValid())
+            finish(restrictImageToSize(frame.toImage(), m_maxSize));
+    });
+    connect(m_player,
+            &QMediaPlayer::errorOccurred,
+            this,
+            [this](QMediaPlayer::Error, const QString &errorString) {
+                qCDebug(logThumb) << "error occurred while creating thumbnail for"
+                                  << m_resolvedFilePath << ":" << errorString;
+                finish({});
+            });
+}
+
+void VideoWorker::start(const QString &resolvedFilePath,
+                        std::optional<qint64> duration,
+                        int maxSize)
 {
-    const QUrl url = QUrl::fromLocalFile(resolvedFilePath);
-    QMediaPlayer player;
-    player.setSource(url);
-    if (!player.isAvailable()) {
+    // many cameras and phones embed a thumbnail, which avoids decoding video at all, if it is
+    // large enough like for embedded previews of pictures
+    const QByteArray embedded = Util::embeddedMovieImage(resolvedFilePath);
+    QImage image;
+    if (!embedded.isEmpty() && image.loadFromData(embedded)
+        && std::max(image.width(), image.height()) >= maxSize) {
+        qDebug(logThumb) << "using embedded image of" << resolvedFilePath;
+        m_done(resolvedFilePath, {restrictImageToSize(image, maxSize), duration});
+        return;
+    }
+    if (!m_player)
+        createPlayer();
+    m_embeddedImage = image;
+    m_resolvedFilePath = resolvedFilePath;
+    m_duration = duration.value_or(0);
+    m_maxSize = maxSize;
+    m_timeout->start();
+    m_player->setSource(QUrl::fromLocalFile(resolvedFilePath));
+    if (!m_player->isAvailable()) {
         qWarning(logThumb) << "QMediaPlayer: not available" << resolvedFilePath;
+        finish({});
         return;
     }
+    if (m_duration > 0) {
+        // the duration from the meta data is enough to seek to the frame without playing
+        m_player->setPosition(m_duration * 3 / 100);
+        m_player->pause();
+    } else {
+        m_player->play();
+    }
+}
 
-    qint64 duration = 0;
-    QVideoSink sink;
-    player.setVideoSink(&sink);
-    QEventLoop loop;
-    QObject::connect(&player,
-                     &QMediaPlayer::playbackStateChanged,
-                     &loop,
-                     [&](QMediaPlayer::PlaybackState state) {
-                         if (state == QMediaPlayer::PlayingState) {
-                             duration = player.duration();
-                             const qint64 snapshotPos = duration * 3 / 100;
-                             player.setPosition(snapshotPos);
-                         }
-                     });
-    QObject::connect(&sink, &QVideoSink::videoFrameChanged, &loop, [&] {
-        fi.addResult({restrictImageToSize(sink.videoFrame().toImage(), maxSize), duration});
-        loop.exit();
-    });
-    QObject::connect(&player,
-                     &QMediaPlayer::errorOccurred,
-                     &loop,
-                     [&](QMediaPlayer::Error error, const QString &errorString) {
-                         qCDebug(logThumb) << "error occurred while creating thumbnail for"
-                                           << resolvedFilePath << ":" << errorString;
-                         loop.exit();
-                     });
-    player.play();
-    loop.exec();
+void VideoWorker::cancel()
+{
+    if (!m_resolvedFilePath.isEmpty())
+        finish({});
+}
+
+void VideoWorker::finish(const QImage &image)
+{
+    if (m_resolvedFilePath.isEmpty())
+        return;
+    m_timeout->stop();
+    const QString resolvedFilePath = std::exchange(m_resolvedFilePath, QString());
+    const qint64 duration = m_duration > 0 ? m_duration : m_player->duration();
+    // releases the file, the player is reused for the next item
+    m_player->stop();
+    m_player->setSource({});
+    const QImage embeddedImage = std::exchange(m_embeddedImage, QImage());
+    m_done(resolvedFilePath,
+           {image.isNull() ? restrictImageToSize(embeddedImage, m_maxSize) : image,
+            duration > 0 ? std::make_optional(duration) : std::nullopt});
 }
 
 class VideoThumbnailer : public Thumbnailer
 {
 public:
+    explicit VideoThumbnailer(int workerCount);
+    ~VideoThumbnailer() override;
+
     MediaType mediaType() const override;
     bool hasCapacity() const override;
     bool isRunning(const QString &resolvedFilePath) const override;
     void cancel(const QString &resolvedFilePath) override;
     void requestThumbnail(const QString &resolvedFilePath,
                           Util::Orientation orientation,
+                          std::optional<qint64> duration,
                           const int maxSize) override;
 
 private:
-    bool isRunning() const { return m_future.isRunning(); }
-    QString m_currentFilePath;
-    QFuture<ThumbnailItem> m_future;
+    class Worker
+    {
+    public:
+        std::unique_ptr<QThread> thread;
+        VideoWorker *worker = nullptr;
+        // empty when idle
+        QString resolvedFilePath;
+        int maxSize = 0;
+        bool isCanceled = false;
+    };
+
+    void finished(std::size_t index, const QString &resolvedFilePath, const ThumbnailItem &item);
+
+    std::vector<Worker> m_workers;
 };
 
+VideoThumbnailer::VideoThumbnailer(int workerCount)
+{
+    for (int i = 0; i < workerCount; ++i) {
+        const std::size_t index = m_workers.size();
+        Worker w;
+        w.thread = std::make_unique<QThread>();
+        w.worker = new VideoWorker([this, index](const QString &resolvedFilePath,
+                                                 const ThumbnailItem &item) {
+            QMetaObject::invokeMethod(
+                this,
+                [this, index, resolvedFilePath, item] { finished(index, resolvedFilePath, item); },
+                Qt::QueuedConnection);
+        });
+        w.worker->moveToThread(w.thread.get());
+        QObject::connect(w.thread.get(), &QThread::finished, w.worker, &QObject::deleteLater);
+        w.thread->start();
+        m_workers.push_back(std::move(w));
+    }
+}
+
+VideoThumbnailer::~VideoThumbnailer()
+{
+    for (Worker &w : m_workers) {
+        QMetaObject::invokeMethod(w.worker, [worker = w.worker] { worker->cancel(); });
+        w.thread->quit();
+    }
+    for (Worker &w : m_workers)
+        w.thread->wait();
+}
+
 MediaType VideoThumbnailer::mediaType() const
 {
     return MediaType::Video;
@@ -197,92 +369,212 @@ MediaType VideoThumbnailer::mediaType() const
 
 bool VideoThumbnailer::hasCapacity() const
 {
-    return !isRunning();
+    return std::any_of(m_workers.cbegin(), m_workers.cend(), [](const Worker &w) {
+        return w.resolvedFilePath.isEmpty();
+    });
 }
 
 bool VideoThumbnailer::isRunning(const QString &resolvedFilePath) const
 {
-    return isRunning() && m_currentFilePath == resolvedFilePath;
+    return std::any_of(m_workers.cbegin(), m_workers.cend(), [resolvedFilePath](const Worker &w) {
+        return !w.isCanceled && w.resolvedFilePath == resolvedFilePath;
+    });
 }
 
 void VideoThumbnailer::cancel(const QString &resolvedFilePath)
 {
-    if (isRunning(resolvedFilePath)) {
-        qDebug(logThumb) << "canceling" << resolvedFilePath;
-        m_future.cancel();
+    for (Worker &w : m_workers) {
+        if (!w.isCanceled && w.resolvedFilePath == resolvedFilePath) {
+            qDebug(logThumb) << "canceling" << resolvedFilePath;
+            // the worker is busy until it stopped the player
+            w.isCanceled = true;
+            QMetaObject::invokeMethod(w.worker, [worker = w.worker] { worker->cancel(); });
+        }
     }
 }
 
 void VideoThumbnailer::requestThumbnail(const QString &resolvedFilePath,
                                         Util::Orientation orientation,
+                                        std::optional<qint64> duration,
                                         const int maxSize)
 {
     Q_UNUSED(orientation)
-    if (isRunning())
-        cancel(m_currentFilePath);
-    qDebug(logThumb) << "starting" << resolvedFilePath;
-    m_currentFilePath = resolvedFilePath;
-    QFutureInterface<ThumbnailItem> foo;
-    m_future = QtConcurrent::run(createVideoThumbnail, resolvedFilePath, maxSize);
-    m_future.then(this, [this, resolvedFilePath](const QFuture<ThumbnailItem> &future) {
-        qDebug(logThumb) << "finished" << resolvedFilePath;
-        if (!future.isCanceled() && future.resultCount() > 0) {
-            const auto result = future.result();
-            emit thumbnailReady(resolvedFilePath, result.image, result.duration);
-        }
+    const auto w = std::find_if(m_workers.begin(), m_workers.end(), [](const Worker &w) {
+        return w.resolvedFilePath.isEmpty();
     });
+    if (w == m_workers.end()) {
+        qWarning(logThumb) << "VideoThumbnailer internal error: no idle worker";
+        return;
+    }
+    qDebug(logThumb) << "starting" << resolvedFilePath;
+    w->resolvedFilePath = resolvedFilePath;
+    w->maxSize = maxSize;
+    w->isCanceled = false;
+    QMetaObject::invokeMethod(w->worker,
+                              [worker = w->worker, resolvedFilePath, duration, maxSize] {
+                                  worker->start(resolvedFilePath, duration, maxSize);
+                              });
+}
+
+void VideoThumbnailer::finished(std::size_t index,
+                                const QString &resolvedFilePath,
+                                const ThumbnailItem &item)
+{
+    Worker &w = m_workers.at(index);
+    const bool isCanceled = w.isCanceled;
+    const int maxSize = w.maxSize;
+    w.resolvedFilePath.clear();
+    w.isCanceled = false;
+    if (isCanceled)
+        return;
+    qDebug(logThumb) << "finished" << resolvedFilePath;
+    // also for failed items, which get an empty thumbnail and are not tried again
+    emit thumbnailReady(resolvedFilePath, item.image, maxSize, item.duration);
 }
 
 } // namespace
 
-static auto findPendingItem(std::deque<std::tuple<QString, MediaType, Util::Orientation>> &pending,
-                            const QString &resolvedFilePath)
+// PHOTOBROWSER_VIDEO_THUMBNAIL_WORKERS overrides the default
+static int videoWorkerCount()
 {
-    return std::find_if(pending.begin(),
-                        pending.end(),
-                        [resolvedFilePath](
-                            const std::tuple<QString, MediaType, Util::Orientation> &item) {
-                            return std::get<0>(item) == resolvedFilePath;
-                        });
+    bool ok;
+    const int count = qEnvironmentVariableIntValue("PHOTOBROWSER_VIDEO_THUMBNAIL_WORKERS", &ok);
+    if (ok && count > 0)
+        return count;
+    return std::clamp(QThread::idealThreadCount() / 2, 1, MAX_VIDEO_THUMB_WORKERS);
 }
 
 ThumbnailCreator::ThumbnailCreator()
+    : m_thumbnailSize(DEFAULT_THUMBNAIL_SIZE)
 {
     m_thumbnailers.emplace(MediaType::Image, std::make_unique<PictureThumbnailer>());
-    m_thumbnailers.emplace(MediaType::Video, std::make_unique<VideoThumbnailer>());
+    m_thumbnailers.emplace(MediaType::Video,
+                           std::make_unique<VideoThumbnailer>(videoWorkerCount()));
     for (const auto &thumbnailer : m_thumbnailers) {
         connect(thumbnailer.second.get(),
                 &Thumbnailer::thumbnailReady,
                 this,
                 [this](const QString &resolvedFilePath,
                        const QImage &image,
+                       int maxSize,
                        std::optional<qint64> duration) {
-                    emit thumbnailReady(resolvedFilePath, QPixmap::fromImage(image), duration);
+                    m_runningRows.remove(resolvedFilePath);
+                    emit thumbnailReady(resolvedFilePath,
+                                        QPixmap::fromImage(image),
+                                        maxSize,
+                                        duration);
                     startPending();
                 });
     }
 }
 
-void ThumbnailCreator::requestThumbnail(const MediaItem &item, bool cancelRunning)
+void ThumbnailCreator::requestThumbnail(const MediaItem &item, int row, bool cancelRunning)
 {
     if (cancelRunning)
         cancel(item.resolvedFilePath);
     if (isRunning(item.resolvedFilePath))
         return;
-    if (findPendingItem(m_pending, item.resolvedFilePath) != m_pending.end())
+    const auto pending = m_pending.find(item.resolvedFilePath);
+    if (pending != m_pending.end()) {
+        // rows change when items are inserted
+        pending->row = row;
+        return;
+    }
+    if (!priority(row))
         return;
     qDebug(logThumb) << "requested" << item.resolvedFilePath << "("
                      << (item.type == MediaType::Image ? "Image" : "Video") << ")";
-    auto thumbnailer = m_thumbnailers.at(item.type).get();
-    if (!thumbnailer->hasCapacity()) {
-        while (m_pending.size() >= MAX_PENDING)
-            m_pending.pop_front();
-        m_pending.push_back({item.resolvedFilePath, item.type, item.metaData.orientation});
-        qDebug(logThumb) << "(scheduled)";
-    } else {
-        startItem(item.resolvedFilePath, item.type, item.metaData.orientation);
+    m_pending.insert(item.resolvedFilePath,
+                     {item.type,
+                      item.metaData.orientation,
+                      item.metaData.duration,
+                      row,
+                      m_nextSequence++});
+    while (m_pending.size() > MAX_PENDING)
+        dropLeastImportant();
+    startPending();
+}
+
+void ThumbnailCreator::setViewport(const Viewport &viewport)
+{
+    m_viewport = viewport;
+    for (auto it = m_pending.begin(); it != m_pending.end();) {
+        if (!priority(it->row))
+            it = m_pending.erase(it);
+        else
+            ++it;
     }
-    qDebug(logThumb) << "pending" << m_pending.size();
+    const QHash<QString, int> running = m_runningRows;
+    for (auto it = running.cbegin(); it != running.cend(); ++it) {
+        if (!priority(it.value())) {
+            cancel(it.key());
+            m_runningRows.remove(it.key());
+        }
+    }
+    startPending();
+}
+
+const ThumbnailCreator::Viewport &ThumbnailCreator::viewport() const
+{
+    return m_viewport;
+}
+
+// lower values first, std::nullopt for items that are too far away from the viewport
+std::optional<int> ThumbnailCreator::priority(int row) const
+{
+    if (m_viewport.lastRow < m_viewport.firstRow)
+        return 0;
+    const int visibleCount = m_viewport.lastRow - m_viewport.firstRow + 1;
+    if (row >= m_viewport.firstRow && row <= m_viewport.lastRow)
+        return 0;
+    const int distance = row < m_viewport.firstRow ? m_viewport.firstRow - row
+                                                   : row - m_viewport.lastRow;
+    if (distance > CANCEL_DISTANCE * visibleCount)
+        return {};
+    const int direction = row < m_viewport.firstRow ? -1 : 1;
+    // items behind the scroll direction are needed later than the ones ahead
+    if (m_viewport.direction != 0 && direction != m_viewport.direction)
+        return 2 * distance + visibleCount;
+    return distance;
+}
+
+std::pair<int, quint64> ThumbnailCreator::sortKey(const Request &request) const
+{
+    return {priority(request.row).value_or(std::numeric_limits<int>::max()), request.sequence};
+}
+
+void ThumbnailCreator::dropLeastImportant()
+{
+    auto worst = m_pending.end();
+    std::pair<int, quint64> worstKey;
+    for (auto it = m_pending.begin(); it != m_pending.end(); ++it) {
+        const auto key = sortKey(*it);
+        if (worst == m_pending.end() || key > worstKey) {
+            worst = it;
+            worstKey = key;
+        }
+    }
+    if (worst != m_pending.end())
+        m_pending.erase(worst);
+}
+
+bool ThumbnailCreator::setRequiredSize(int requiredSize)
+{
+    const auto tier = std::find_if(std::begin(THUMBNAIL_SIZES),
+                                   std::end(THUMBNAIL_SIZES),
+                                   [requiredSize](int size) { return size >= requiredSize; });
+    const int size = tier != std::end(THUMBNAIL_SIZES) ? *tier : *std::rbegin(THUMBNAIL_SIZES);
+    if (size == m_thumbnailSize)
+        return false;
+    qDebug(logThumb) << "thumbnail size" << size << "for" << requiredSize;
+    m_thumbnailSize = size;
+    // pending items are started with the new size
+    return true;
+}
+
+int ThumbnailCreator::thumbnailSize() const
+{
+    return m_thumbnailSize;
 }
 
 void ThumbnailCreator::cancel(const QString &resolvedFilePath)
@@ -302,31 +594,46 @@ bool ThumbnailCreator::isRunning(const QString &resolvedFilePath)
                        });
 }
 
-void ThumbnailCreator::startItem(const QString &resolvedFilePath,
-                                 const MediaType type,
-                                 Util::Orientation orientation)
+void ThumbnailCreator::startItem(const QString &resolvedFilePath, const Request &request)
 {
-    auto thumbnailer = m_thumbnailers.at(type).get();
-    thumbnailer->requestThumbnail(resolvedFilePath, orientation, THUMBNAIL_SIZE);
+    auto thumbnailer = m_thumbnailers.at(request.type).get();
+    m_runningRows.insert(resolvedFilePath, request.row);
+    thumbnailer->requestThumbnail(resolvedFilePath,
+                                  request.orientation,
+                                  request.duration,
+                                  m_thumbnailSize);
 }
 
 void ThumbnailCreator::startPending()
 {
-    if (m_pending.empty())
+    // thumbnailers do not report failed items
+    for (auto it = m_runningRows.begin(); it != m_runningRows.end();) {
+        if (!isRunning(it.key()))
+            it = m_runningRows.erase(it);
+        else
+            ++it;
+    }
+    // decoding is deferred while items fly by
+    if (m_viewport.isScrollingFast)
         return;
-    auto it = std::begin(m_pending);
-    const auto end = std::end(m_pending);
-    while (it != end) {
-        if (m_thumbnailers.at(std::get<1>(*it))->hasCapacity()) {
-            QString filePath;
-            MediaType type;
-            Util::Orientation orientation;
-            std::tie(filePath, type, orientation) = *it;
-            m_pending.erase(it);
-            startItem(filePath, type, orientation);
-            break;
+    while (!m_pending.isEmpty()) {
+        auto best = m_pending.end();
+        std::pair<int, quint64> bestKey;
+        for (auto it = m_pending.begin(); it != m_pending.end(); ++it) {
+            if (!m_thumbnailers.at(it->type)->hasCapacity())
+                continue;
+            const auto key = sortKey(*it);
+            if (best == m_pending.end() || key < bestKey) {
+                best = it;
+                bestKey = key;
+            }
         }
-        ++it;
+        if (best == m_pending.end())
+            break;
+        const QString filePath = best.key();
+        const Request request = best.value();
+        m_pending.erase(best);
+        startItem(filePath, request);
     }
     qDebug(logThumb) << "pending" << m_pending.size();
 }
@@ -3,8 +3,8 @@
 #include <util/metadatautil.h>
 
 #include <QFutureWatcher>
+#include <QHash>
 
-#include <deque>
 #include <unordered_map>
 
 class MediaItem;
@@ -19,14 +19,17 @@ public:
     virtual bool hasCapacity() const = 0;
     virtual bool isRunning(const QString &resolvedFilePath) const = 0;
     virtual void cancel(const QString &resolvedFilePath) = 0;
+    // the duration is std::nullopt if it is not known from the meta data
     virtual void requestThumbnail(const QString &resolvedFilePath,
                                   Util::Orientation orientation,
+                                  std::optional<qint64> duration,
                                   const int maxSize)
         = 0;
 
 signals:
     void thumbnailReady(const QString &resolvedFilePath,
                         const QImage &image,
+                        int maxSize,
                         std::optional<qint64> duration);
 };
 
@@ -35,23 +38,62 @@ class ThumbnailCreator : public QObject
     Q_OBJECT
 
 public:
+    // the part of the film strip that is shown, and how it scrolls
+    class Viewport
+    {
+    public:
+        int firstRow = 0;
+        int lastRow = -1; // no viewport
+        int direction = 0; // 1 for scrolling towards higher rows, -1 towards lower rows
+        bool isScrollingFast = false;
+    };
+
     ThumbnailCreator();
 
-    void requestThumbnail(const MediaItem &item, bool cancelRunning = false);
+    // Requests are started by priority: items in the viewport first, then the ones ahead in the
+    // scroll direction, then the ones behind. Requests for items that are far away from the
+    // viewport are dropped, and nothing is started while scrolling fast.
+    void requestThumbnail(const MediaItem &item, int row, bool cancelRunning = false);
+    // cancels work for items that are far away now
+    void setViewport(const Viewport &viewport);
+    const Viewport &viewport() const;
+
+    // Thumbnails are created in a few fixed sizes, the smallest one that is at least requiredSize
+    // on the longer side is used for new thumbnails. Returns true if that changed the size.
+    bool setRequiredSize(int requiredSize);
+    int thumbnailSize() const;
 
 signals:
+    // size is the thumbnail size that the thumbnail was created for
     void thumbnailReady(const QString &resolvedFilePath,
                         const QPixmap &pixmap,
+                        int size,
                         std::optional<qint64> duration);
 
 private:
+    class Request
+    {
+    public:
+        MediaType type;
+        Util::Orientation orientation;
+        std::optional<qint64> duration;
+        int row = 0;
+        quint64 sequence = 0; // earlier requests first for the same priority
+    };
+
     bool isRunning(const QString &resolvedFilePath);
     void cancel(const QString &resolvedFilePath);
-    void startItem(const QString &resolvedFilePath,
-                   const MediaType type,
-                   Util::Orientation orientation);
+    std::optional<int> priority(int row) const;
+    std::pair<int, quint64> sortKey(const Request &request) const;
+    void dropLeastImportant();
+    void startItem(const QString &resolvedFilePath, const Request &request);
     void startPending();
 
-    std::deque<std::tuple<QString, MediaType, Util::Orientation>> m_pending;
+    QHash<QString, Request> m_pending;
+    // rows of the items that are running, for canceling them when they are far away
+    QHash<QString, int> m_runningRows;
     std::unordered_map<MediaType, std::unique_ptr<Thumbnailer>> m_thumbnailers;
+    Viewport m_viewport;
+    quint64 m_nextSequence = 0;
+    int m_thumbnailSize;
 };
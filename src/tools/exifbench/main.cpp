@@ -0,0 +1,131 @@
+#include <util/exifparser.h>
+#include <util/fileprobe.h>
+#include <util/metadatautil.h>
+
+#include <QCoreApplication>
+#include <QDirListing>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+
+// same as the browser reads when scanning
+const qsizetype kHeaderSize = 64 * 1024;
+
+class Fixture
+{
+public:
+    QString filePath;
+    Util::FileProbe probe;
+};
+
+static std::optional<Fixture> loadFixture(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return {};
+    Fixture fixture;
+    fixture.filePath = filePath;
+    fixture.probe.header = file.read(kHeaderSize);
+    fixture.probe.stat = Util::FileStat();
+    fixture.probe.stat->size = file.size();
+    // measure meta data parsing, not reading extended attributes
+    fixture.probe.attribute = QByteArray();
+    return fixture;
+}
+
+static std::vector<Fixture> loadFixtures(const QStringList &paths)
+{
+    std::vector<Fixture> fixtures;
+    const auto add = [&fixtures](const QString &filePath) {
+        if (auto fixture = loadFixture(filePath))
+            fixtures.push_back(*fixture);
+    };
+    for (const QString &path : paths) {
+        if (!QFileInfo(path).isDir()) {
+            add(path);
+            continue;
+        }
+        for (const auto &entry : QDirListing(path,
+                                             QDirListing::IteratorFlag::FilesOnly
+                                                 | QDirListing::IteratorFlag::Recursive)) {
+            add(entry.filePath());
+        }
+    }
+    return fixtures;
+}
+
+static qint64 run(const std::vector<Fixture> &fixtures, int iterations, Util::MetaDataParser parser)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        for (const Fixture &fixture : fixtures)
+            Util::metaData(fixture.filePath, fixture.probe, parser);
+    }
+    return timer.nsecsElapsed();
+}
+
+static bool isSame(const Util::MetaData &a, const Util::MetaData &b)
+{
+    const auto thumbnailSize = [](const Util::MetaData &data) {
+        return data.thumbnail ? data.thumbnail->size : 0;
+    };
+    const auto position = [](const Util::MetaData &data) {
+        return data.position ? std::make_pair(data.position->latitude, data.position->longitude)
+                             : std::make_pair(1000., 1000.);
+    };
+    return a.created == b.created && a.orientation == b.orientation
+           && a.dimensions == b.dimensions && thumbnailSize(a) == thumbnailSize(b)
+           && a.camera == b.camera && a.lens == b.lens && a.iso == b.iso
+           && a.focalLength == b.focalLength && position(a) == position(b);
+}
+
+// Compares the native Exif parser with exiv2 on a set of files:
+//   exifbench [-n iterations] file-or-directory...
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QStringList args = QCoreApplication::arguments().mid(1);
+    int iterations = 10;
+    if (args.size() >= 2 && args.first() == "-n") {
+        iterations = std::max(1, args.at(1).toInt());
+        args = args.mid(2);
+    }
+    QTextStream out(stdout);
+    if (args.isEmpty()) {
+        out << "usage: exifbench [-n iterations] file-or-directory...\n";
+        return 1;
+    }
+
+    const std::vector<Fixture> fixtures = loadFixtures(args);
+    int nativeCount = 0;
+    for (const Fixture &fixture : fixtures) {
+        if (!Util::parseExif(fixture.probe.header, fixture.probe.stat->size))
+            continue;
+        ++nativeCount;
+        const auto native = Util::metaData(fixture.filePath,
+                                           fixture.probe,
+                                           Util::MetaDataParser::Auto);
+        const auto exiv2 = Util::metaData(fixture.filePath,
+                                          fixture.probe,
+                                          Util::MetaDataParser::Exiv2);
+        if (!isSame(native, exiv2))
+            out << "differs from exiv2: " << fixture.filePath << "\n";
+    }
+    out << fixtures.size() << " files, " << nativeCount << " handled by the native parser\n";
+    if (fixtures.empty())
+        return 0;
+
+    // warm up caches
+    run(fixtures, 1, Util::MetaDataParser::Exiv2);
+    const qint64 exiv2Time = run(fixtures, iterations, Util::MetaDataParser::Exiv2);
+    const qint64 autoTime = run(fixtures, iterations, Util::MetaDataParser::Auto);
+    const auto perFile = [&](qint64 nsecs) {
+        return double(nsecs) / 1000. / double(iterations * fixtures.size());
+    };
+    out << "exiv2:  " << perFile(exiv2Time) << " us/file\n";
+    out << "native: " << perFile(autoTime) << " us/file\n";
+    out << "speedup: " << (autoTime > 0 ? double(exiv2Time) / double(autoTime) : 0.) << "x\n";
+    return 0;
+}
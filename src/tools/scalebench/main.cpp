@@ -0,0 +1,105 @@
+#include <util/downscale.h>
+
+#include <QCoreApplication>
+#include <QDirListing>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImage>
+#include <QTextStream>
+
+#include <functional>
+
+static std::vector<QImage> loadImages(const QStringList &paths)
+{
+    std::vector<QImage> images;
+    const auto add = [&images](const QString &filePath) {
+        QImage image(filePath);
+        if (!image.isNull())
+            images.push_back(image.convertToFormat(QImage::Format_RGB32));
+    };
+    for (const QString &path : paths) {
+        if (!QFileInfo(path).isDir()) {
+            add(path);
+            continue;
+        }
+        for (const auto &entry : QDirListing(path,
+                                             QDirListing::IteratorFlag::FilesOnly
+                                                 | QDirListing::IteratorFlag::Recursive)) {
+            add(entry.filePath());
+        }
+    }
+    return images;
+}
+
+// 45 MP, like a high resolution camera
+static QImage syntheticImage()
+{
+    QImage image(8256, 5504, QImage::Format_RGB32);
+    for (int y = 0; y < image.height(); ++y) {
+        auto line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < image.width(); ++x)
+            line[x] = qRgb(x & 0xff, y & 0xff, (x ^ y) & 0xff);
+    }
+    return image;
+}
+
+static qint64 run(const std::vector<QImage> &images,
+                  int iterations,
+                  const std::function<QImage(const QImage &)> &scale)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i) {
+        for (const QImage &image : images)
+            scale(image);
+    }
+    return timer.nsecsElapsed();
+}
+
+// Compares the area filter downscaler with QImage's smooth scaling:
+//   scalebench [-n iterations] [-s size] [file-or-directory...]
+// Uses a synthetic 45 MP image if no files are given.
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QStringList args = QCoreApplication::arguments().mid(1);
+    int iterations = 5;
+    int size = 400;
+    while (args.size() >= 2 && (args.first() == "-n" || args.first() == "-s")) {
+        const int value = std::max(1, args.at(1).toInt());
+        if (args.first() == "-n")
+            iterations = value;
+        else
+            size = value;
+        args = args.mid(2);
+    }
+    QTextStream out(stdout);
+    const std::vector<QImage> images = args.isEmpty() ? std::vector<QImage>{syntheticImage()}
+                                                      : loadImages(args);
+    out << images.size() << " images, scaled to " << size << " pixels\n";
+    if (images.empty())
+        return 0;
+
+    const QSize target(size, size);
+    const auto perImage = [&](qint64 nsecs) {
+        return double(nsecs) / 1000000. / double(iterations * images.size());
+    };
+    const qint64 qtTime = run(images, iterations, [target](const QImage &image) {
+        return image.scaled(target, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    });
+    out << "Qt:     " << perImage(qtTime) << " ms/image\n";
+    const std::vector<std::pair<Util::DownscaleImplementation, QString>> implementations
+        = {{Util::DownscaleImplementation::Scalar, "scalar: "},
+           {Util::DownscaleImplementation::Sse2, "SSE2:   "},
+           {Util::DownscaleImplementation::Avx2, "AVX2:   "}};
+    for (const auto &implementation : implementations) {
+        if (!Util::isSupported(implementation.first))
+            continue;
+        const qint64 time = run(images, iterations, [&](const QImage &image) {
+            return Util::downscaled(image, target, implementation.first);
+        });
+        out << implementation.second << perImage(time) << " ms/image, speedup "
+            << (time > 0 ? double(qtTime) / double(time) : 0.) << "x\n";
+    }
+    return 0;
+}
@@ -0,0 +1,359 @@
+#include "bmffparser.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QTimeZone>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace {
+
+// guards against broken files with endless box lists
+const int kMaxBoxCount = 1024;
+// the header boxes that are parsed are around 100 bytes
+const qint64 kMaxHeaderBoxSize = 256;
+// embedded thumbnails and cover art are much smaller, larger boxes are probably broken
+const qint64 kMaxImageBoxSize = 8 * 1024 * 1024;
+// uuid of boxes with an XMP packet
+const char kXmpUuid[] = "\xbe\x7a\xcf\xcb\x97\xa9\x42\xe8\x9c\x71\x99\x94\x91\xe3\xaf\xac";
+
+quint32 be32(const QByteArray &data, qsizetype pos)
+{
+    const auto d = reinterpret_cast<const uchar *>(data.constData()) + pos;
+    return (quint32(d[0]) << 24) | (quint32(d[1]) << 16) | (quint32(d[2]) << 8) | d[3];
+}
+
+quint64 be64(const QByteArray &data, qsizetype pos)
+{
+    return (quint64(be32(data, pos)) << 32) | be32(data, pos + 4);
+}
+
+// reads from the already known start of the file where possible
+class BoxReader
+{
+public:
+    BoxReader(const QString &filePath, const QByteArray &header, qint64 fileSize)
+        : m_file(filePath)
+        , m_header(header)
+        , m_size(fileSize)
+    {}
+
+    QByteArray read(qint64 offset, qint64 count)
+    {
+        count = std::min(count, m_size - offset);
+        if (count <= 0)
+            return {};
+        if (offset + count <= m_header.size())
+            return m_header.mid(offset, count);
+        if (!m_file.isOpen() && !m_file.open(QIODevice::ReadOnly))
+            return {};
+        if (!m_file.seek(offset))
+            return {};
+        return m_file.read(count);
+    }
+
+    qint64 size() const { return m_size; }
+
+private:
+    QFile m_file;
+    QByteArray m_header;
+    qint64 m_size;
+};
+
+class Box
+{
+public:
+    QByteArray type;
+    qint64 contentOffset;
+    qint64 end;
+
+    qint64 contentSize() const { return end - contentOffset; }
+};
+
+std::optional<Box> readBox(BoxReader &reader, qint64 offset, qint64 parentEnd)
+{
+    if (offset + 8 > parentEnd)
+        return {};
+    const QByteArray header = reader.read(offset, 16);
+    if (header.size() < 8)
+        return {};
+    quint64 size = be32(header, 0);
+    qint64 contentOffset = offset + 8;
+    if (size == 1) {
+        if (header.size() < 16)
+            return {};
+        size = be64(header, 8);
+        contentOffset += 8;
+    } else if (size == 0) {
+        // extends to the end of the file
+        size = quint64(parentEnd - offset);
+    }
+    if (size < quint64(contentOffset - offset) || size > quint64(parentEnd - offset))
+        return {};
+    return Box{header.mid(4, 4), contentOffset, offset + qint64(size)};
+}
+
+// calls handle for the child boxes in [begin, end) until it returns false
+template<typename Handler>
+void forEachBox(BoxReader &reader, qint64 begin, qint64 end, const Handler &handle)
+{
+    qint64 offset = begin;
+    for (int i = 0; i < kMaxBoxCount && offset < end; ++i) {
+        const std::optional<Box> box = readBox(reader, offset, end);
+        if (!box || !handle(*box))
+            return;
+        offset = box->end;
+    }
+}
+
+QByteArray readContent(BoxReader &reader, const Box &box)
+{
+    return reader.read(box.contentOffset, std::min(box.contentSize(), kMaxHeaderBoxSize));
+}
+
+class TimeHeader
+{
+public:
+    quint64 creationTime = 0; // seconds since 1904
+    qint64 duration = 0; // milliseconds
+};
+
+// mvhd and mdhd share the layout of the fields we need
+std::optional<TimeHeader> parseTimeHeader(const QByteArray &content)
+{
+    if (content.size() < 20)
+        return {};
+    const bool isVersion1 = content.at(0) == 1;
+    if (isVersion1 && content.size() < 32)
+        return {};
+    TimeHeader result;
+    quint32 timeScale;
+    quint64 duration;
+    if (isVersion1) {
+        result.creationTime = be64(content, 4);
+        timeScale = be32(content, 20);
+        duration = be64(content, 24);
+    } else {
+        result.creationTime = be32(content, 4);
+        timeScale = be32(content, 12);
+        duration = be32(content, 16);
+        // all bits set means unknown
+        if (duration == 0xffffffff)
+            duration = 0;
+    }
+    if (timeScale > 0 && duration < quint64(std::numeric_limits<qint64>::max() / 1000))
+        result.duration = qint64(duration * 1000 / timeScale);
+    return result;
+}
+
+// display size from a tkhd box, taking rotation into account
+std::optional<QSize> parseTrackHeader(const QByteArray &content)
+{
+    const bool isVersion1 = !content.isEmpty() && content.at(0) == 1;
+    const qsizetype matrixPos = isVersion1 ? 52 : 40;
+    const qsizetype sizePos = isVersion1 ? 88 : 76;
+    if (content.size() < sizePos + 8)
+        return {};
+    // 16.16 fixed point
+    const int width = int(be32(content, sizePos) >> 16);
+    const int height = int(be32(content, sizePos + 4) >> 16);
+    if (width <= 0 || height <= 0)
+        return {};
+    // a and d of the transformation matrix are 0 for rotations by 90 and 270 degrees
+    const bool isRotated = be32(content, matrixPos) == 0 && be32(content, matrixPos + 16) == 0;
+    return isRotated ? QSize(height, width) : QSize(width, height);
+}
+
+class Track
+{
+public:
+    bool isVideo = false;
+    std::optional<QSize> dimensions;
+    qint64 duration = 0;
+};
+
+Track parseTrack(BoxReader &reader, const Box &trak)
+{
+    Track track;
+    forEachBox(reader, trak.contentOffset, trak.end, [&](const Box &box) {
+        if (box.type == "tkhd") {
+            track.dimensions = parseTrackHeader(readContent(reader, box));
+        } else if (box.type == "mdia") {
+            forEachBox(reader, box.contentOffset, box.end, [&](const Box &child) {
+                if (child.type == "hdlr") {
+                    // version/flags, pre_defined, handler_type
+                    const QByteArray content = readContent(reader, child);
+                    track.isVideo = content.mid(8, 4) == "vide";
+                } else if (child.type == "mdhd") {
+                    if (const auto header = parseTimeHeader(readContent(reader, child)))
+                        track.duration = header->duration;
+                }
+                return true;
+            });
+        }
+        return true;
+    });
+    return track;
+}
+
+QByteArray readImageContent(BoxReader &reader, const Box &box, qint64 skip = 0)
+{
+    if (box.contentSize() - skip <= 0 || box.contentSize() > kMaxImageBoxSize)
+        return {};
+    return reader.read(box.contentOffset + skip, box.contentSize() - skip);
+}
+
+// the JPEG in thumbnail boxes of some cameras comes after a small header
+QByteArray jpegFrom(const QByteArray &content)
+{
+    const qsizetype start = content.indexOf("\xff\xd8\xff");
+    return start >= 0 ? content.mid(start) : QByteArray();
+}
+
+// the xmpGImg:image of the first xmp:Thumbnails entry, as element or attribute
+QByteArray imageFromXmp(const QByteArray &xmp)
+{
+    static const QRegularExpression rx(
+        R"rx(xmpGImg:image(?:>([^<]*)</xmpGImg:image>|\s*=\s*"([^"]*)"))rx");
+    const QRegularExpressionMatch match = rx.match(QString::fromUtf8(xmp));
+    if (!match.hasMatch())
+        return {};
+    QString base64 = match.captured(1).isEmpty() ? match.captured(2) : match.captured(1);
+    // line breaks are usually written as character references
+    base64.remove("&#xA;").remove(QRegularExpression(R"(\s)"));
+    return jpegFrom(QByteArray::fromBase64(base64.toLatin1()));
+}
+
+// cover art in an iTunes style item list, the data box starts with type and locale
+QByteArray coverFromMeta(BoxReader &reader, const Box &meta)
+{
+    // meta is a full box in MP4, but not in QuickTime
+    const QByteArray start = reader.read(meta.contentOffset, 4);
+    const qint64 begin = meta.contentOffset + (start == QByteArray(4, '\0') ? 4 : 0);
+    QByteArray image;
+    forEachBox(reader, begin, meta.end, [&](const Box &box) {
+        if (box.type != "ilst")
+            return true;
+        forEachBox(reader, box.contentOffset, box.end, [&](const Box &item) {
+            if (item.type != "covr")
+                return true;
+            forEachBox(reader, item.contentOffset, item.end, [&](const Box &data) {
+                if (data.type == "data")
+                    image = readImageContent(reader, data, 8);
+                return image.isEmpty();
+            });
+            return false;
+        });
+        return false;
+    });
+    return image;
+}
+
+bool isTopLevelBoxType(const QByteArray &type)
+{
+    static const std::vector<QByteArray> types
+        = {"ftyp", "moov", "mdat", "free", "skip", "wide", "pnot", "uuid"};
+    return std::find(types.cbegin(), types.cend(), type) != types.cend();
+}
+
+} // namespace
+
+namespace Util {
+
+std::optional<MovieFields> parseMovie(const QString &filePath,
+                                      const QByteArray &header,
+                                      std::optional<qint64> fileSize)
+{
+    // decide from the header alone, so other files do not cause any I/O
+    if (header.size() < 8 || !isTopLevelBoxType(header.mid(4, 4)))
+        return {};
+    BoxReader reader(filePath, header, fileSize ? *fileSize : QFileInfo(filePath).size());
+    std::optional<Box> moov;
+    forEachBox(reader, 0, reader.size(), [&moov](const Box &box) {
+        if (box.type == "moov") {
+            moov = box;
+            return false;
+        }
+        return true;
+    });
+    if (!moov)
+        return {};
+
+    std::optional<TimeHeader> movieHeader;
+    std::vector<Track> tracks;
+    forEachBox(reader, moov->contentOffset, moov->end, [&](const Box &box) {
+        if (box.type == "mvhd")
+            movieHeader = parseTimeHeader(readContent(reader, box));
+        else if (box.type == "trak")
+            tracks.push_back(parseTrack(reader, box));
+        return true;
+    });
+    if (!movieHeader)
+        return {};
+
+    MovieFields fields;
+    if (movieHeader->creationTime > 0) {
+        static const QDateTime base({1904, 1, 1}, QTime(0, 0), QTimeZone::UTC);
+        fields.created = base.addSecs(qint64(movieHeader->creationTime)).toLocalTime();
+    }
+    qint64 duration = movieHeader->duration;
+    for (const Track &track : tracks) {
+        // fragmented files only have the durations in the tracks
+        duration = std::max(duration, track.duration);
+        if (track.isVideo && !fields.dimensions)
+            fields.dimensions = track.dimensions;
+    }
+    if (duration > 0)
+        fields.duration = duration;
+    return fields;
+}
+
+QByteArray embeddedMovieImage(const QString &filePath)
+{
+    BoxReader reader(filePath, {}, QFileInfo(filePath).size());
+    const QByteArray header = reader.read(0, 8);
+    if (header.size() < 8 || !isTopLevelBoxType(header.mid(4, 4)))
+        return {};
+    const QByteArray xmpUuid(kXmpUuid, 16);
+    QByteArray thumbnail;
+    QByteArray cover;
+    QByteArray xmpImage;
+    const auto readXmp = [&](const Box &box, qint64 skip) {
+        if (xmpImage.isEmpty())
+            xmpImage = imageFromXmp(readImageContent(reader, box, skip));
+    };
+    const auto isXmpBox = [&](const Box &box) {
+        return box.type == "uuid" && reader.read(box.contentOffset, 16) == xmpUuid;
+    };
+    forEachBox(reader, 0, reader.size(), [&](const Box &box) {
+        if (isXmpBox(box)) {
+            readXmp(box, 16);
+        } else if (box.type == "moov") {
+            forEachBox(reader, box.contentOffset, box.end, [&](const Box &child) {
+                if (child.type != "udta")
+                    return true;
+                forEachBox(reader, child.contentOffset, child.end, [&](const Box &data) {
+                    if (data.type == "thmb" || data.type == "CNTH")
+                        thumbnail = jpegFrom(readImageContent(reader, data));
+                    else if (data.type == "meta")
+                        cover = coverFromMeta(reader, data);
+                    else if (data.type == "XMP_")
+                        readXmp(data, 0);
+                    return true;
+                });
+                return true;
+            });
+        }
+        return true;
+    });
+    if (!thumbnail.isEmpty())
+        return thumbnail;
+    if (!cover.isEmpty())
+        return cover;
+    return xmpImage;
+}
+
+} // namespace Util
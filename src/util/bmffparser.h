@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QSize>
+#include <QString>
+
+#include <optional>
+
+namespace Util {
+
+// the fields of MP4/QuickTime movies that are needed for scanning directories
+class MovieFields
+{
+public:
+    std::optional<QDateTime> created;
+    std::optional<qint64> duration; // milliseconds
+    std::optional<QSize> dimensions; // of the first video track, as displayed
+};
+
+// Reads the movie and track headers of an ISO base media file (MP4, MOV, 3GP, ...) by walking
+// the box structure. Only box headers and the few header boxes are read, using header (the start
+// of the file) where possible and seeking over everything else.
+// Returns std::nullopt if the file is not an ISO base media file or has no movie header.
+std::optional<MovieFields> parseMovie(const QString &filePath,
+                                      const QByteArray &header,
+                                      std::optional<qint64> fileSize);
+
+// Finds an image that cameras and phones embed in MP4/QuickTime files: a thumbnail in
+// moov/udta/thmb or CNTH, cover art in moov/udta/meta/ilst/covr, or a thumbnail in the XMP packet.
+// Returns the encoded image, or an empty array if there is none.
+QByteArray embeddedMovieImage(const QString &filePath);
+
+} // namespace Util
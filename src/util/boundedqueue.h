@@ -0,0 +1,196 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+namespace Util {
+
+// Bounded multi-producer multi-consumer queue without locks (Dmitry Vyukov's algorithm).
+// The number of producers is fixed up front. Each producer calls producerFinished() when it is
+// done, which lets consumers distinguish "empty for now" from "empty for good".
+// Producers of a full queue and consumers of an empty one block on a condition variable, which
+// is only locked when somebody waits.
+template<typename T>
+class BoundedQueue
+{
+public:
+    using Deadline = std::chrono::steady_clock::time_point;
+
+    BoundedQueue(std::size_t capacity, int producerCount)
+        : m_producers(producerCount)
+    {
+        std::size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        m_mask = size - 1;
+        m_cells = std::make_unique<Cell[]>(size);
+        for (std::size_t i = 0; i < size; ++i)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    // Returns false if the queue is full, value is left untouched in that case.
+    bool tryPush(T &value)
+    {
+        std::size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        Cell *cell;
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = std::ptrdiff_t(sequence) - std::ptrdiff_t(pos);
+            if (diff == 0) {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty.
+    bool tryPop(T &value)
+    {
+        std::size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        Cell *cell;
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = std::ptrdiff_t(sequence) - std::ptrdiff_t(pos + 1);
+            if (diff == 0) {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->value);
+        cell->value = T();
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Waits until there is room for the value.
+    // Returns false if isCanceled returned true before that.
+    template<typename Predicate>
+    bool push(T value, const Predicate &isCanceled)
+    {
+        while (!tryPush(value)) {
+            if (isCanceled())
+                return false;
+            waitUntil(Deadline::max(), [this] { return !isFull(); });
+        }
+        notify();
+        return true;
+    }
+
+    // Waits until a value is available.
+    // Returns false if all producers finished and the queue is drained, if isCanceled returned
+    // true before a value was available, or if the deadline passed.
+    template<typename Predicate>
+    bool pop(T &value, const Predicate &isCanceled, Deadline deadline = Deadline::max())
+    {
+        while (!tryPop(value)) {
+            if (isCanceled())
+                return false;
+            // values pushed before the last producer finished are visible after this
+            if (isClosed()) {
+                if (!tryPop(value))
+                    return false;
+                break;
+            }
+            if (std::chrono::steady_clock::now() >= deadline)
+                return false;
+            waitUntil(deadline, [this] { return !isEmpty() || isClosed(); });
+        }
+        notify();
+        return true;
+    }
+
+    void producerFinished()
+    {
+        m_producers.fetch_sub(1, std::memory_order_acq_rel);
+        notify();
+    }
+
+    // Whether all producers finished. The queue can still contain values.
+    bool isClosed() const { return m_producers.load(std::memory_order_acquire) <= 0; }
+    // Whether all producers finished and all values were taken.
+    bool isDrained() const { return isClosed() && isEmpty(); }
+
+private:
+    // waiting wakes up regularly, because canceling does not notify
+    static constexpr std::chrono::milliseconds kCancelCheckInterval{20};
+
+    // hints, the state can change right after
+    bool isEmpty() const
+    {
+        const std::size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        const std::size_t sequence = m_cells[pos & m_mask].sequence.load(std::memory_order_acquire);
+        return std::ptrdiff_t(sequence) - std::ptrdiff_t(pos + 1) < 0;
+    }
+
+    bool isFull() const
+    {
+        const std::size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        const std::size_t sequence = m_cells[pos & m_mask].sequence.load(std::memory_order_acquire);
+        return std::ptrdiff_t(sequence) - std::ptrdiff_t(pos) < 0;
+    }
+
+    // Blocks until condition returns true, the queue changed, the deadline passed, or for
+    // kCancelCheckInterval.
+    template<typename Condition>
+    void waitUntil(Deadline deadline, const Condition &condition)
+    {
+        std::unique_lock<std::mutex> lock(m_waitMutex);
+        m_waiting.fetch_add(1, std::memory_order_relaxed);
+        // pairs with the fence in notify, so either the condition sees the change, or notify
+        // sees the waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const Deadline now = std::chrono::steady_clock::now();
+        const Deadline until = deadline - now < kCancelCheckInterval ? deadline
+                                                                       : now + kCancelCheckInterval;
+        m_changed.wait_until(lock, until, condition);
+        m_waiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // wakes up waiting producers and consumers, without locking if nobody waits
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiting.load(std::memory_order_relaxed) == 0)
+            return;
+        std::lock_guard<std::mutex> lock(m_waitMutex);
+        m_changed.notify_all();
+    }
+
+    class Cell
+    {
+    public:
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    std::size_t m_mask = 0;
+    alignas(64) std::atomic<std::size_t> m_enqueuePos{0};
+    alignas(64) std::atomic<std::size_t> m_dequeuePos{0};
+    alignas(64) std::atomic<int> m_producers;
+    std::atomic<int> m_waiting{0};
+    std::mutex m_waitMutex;
+    std::condition_variable m_changed;
+};
+
+} // namespace Util
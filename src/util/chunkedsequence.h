@@ -0,0 +1,466 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Util {
+
+/*
+ * Sequence container implemented as a counted B+ tree ("rope").
+ * Leaves hold chunks of pointers to the elements, inner nodes keep the number of elements in
+ * their subtrees. Access by index, insertion and removal are logarithmic, and elements are never
+ * moved in memory, so pointers to elements stay valid until they are removed.
+ */
+template<typename T, std::size_t LeafCapacity = 256, std::size_t NodeCapacity = 64>
+class ChunkedSequence
+{
+    class Inner;
+
+    class Node
+    {
+    public:
+        explicit Node(bool isLeaf)
+            : isLeaf(isLeaf)
+        {}
+        virtual ~Node() = default;
+
+        Inner *parent = nullptr;
+        std::size_t count = 0;
+        const bool isLeaf;
+    };
+
+    class Leaf : public Node
+    {
+    public:
+        Leaf()
+            : Node(true)
+        {}
+
+        std::vector<std::unique_ptr<T>> items;
+        Leaf *next = nullptr;
+        Leaf *previous = nullptr;
+    };
+
+    class Inner : public Node
+    {
+    public:
+        Inner()
+            : Node(false)
+        {}
+
+        std::vector<std::unique_ptr<Node>> children;
+    };
+
+public:
+    template<bool IsConst>
+    class Iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<IsConst, const T *, T *>;
+        using reference = std::conditional_t<IsConst, const T &, T &>;
+
+        Iterator() = default;
+
+        reference operator*() const { return *m_leaf->items[m_position]; }
+        pointer operator->() const { return m_leaf->items[m_position].get(); }
+        Iterator &operator++()
+        {
+            ++m_index;
+            if (++m_position >= m_leaf->items.size()) {
+                m_leaf = m_leaf->next;
+                m_position = 0;
+            }
+            return *this;
+        }
+        Iterator operator++(int)
+        {
+            Iterator it = *this;
+            ++(*this);
+            return it;
+        }
+        bool operator==(const Iterator &other) const
+        {
+            return m_leaf == other.m_leaf && m_position == other.m_position;
+        }
+        bool operator!=(const Iterator &other) const { return !(*this == other); }
+
+        // index of the element in the sequence
+        std::size_t index() const { return m_index; }
+
+    private:
+        friend class ChunkedSequence;
+        Iterator(Leaf *leaf, std::size_t position, std::size_t index)
+            : m_leaf(leaf)
+            , m_position(position)
+            , m_index(index)
+        {}
+
+        Leaf *m_leaf = nullptr;
+        std::size_t m_position = 0;
+        std::size_t m_index = 0;
+    };
+
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+    using value_type = T;
+    using size_type = std::size_t;
+
+    ChunkedSequence() = default;
+    ChunkedSequence(const ChunkedSequence &) = delete;
+    ChunkedSequence &operator=(const ChunkedSequence &) = delete;
+    ChunkedSequence(ChunkedSequence &&other) noexcept
+        : m_root(std::move(other.m_root))
+        , m_first(std::exchange(other.m_first, nullptr))
+        , m_leafOf(std::move(other.m_leafOf))
+    {}
+    ChunkedSequence &operator=(ChunkedSequence &&other) noexcept
+    {
+        m_root = std::move(other.m_root);
+        m_first = std::exchange(other.m_first, nullptr);
+        m_leafOf = std::move(other.m_leafOf);
+        return *this;
+    }
+
+    std::size_t size() const { return m_root ? m_root->count : 0; }
+    bool empty() const { return size() == 0; }
+
+    T &at(std::size_t index)
+    {
+        const auto location = locate(index);
+        return *location.first->items[location.second];
+    }
+    const T &at(std::size_t index) const
+    {
+        const auto location = locate(index);
+        return *location.first->items[location.second];
+    }
+    T &operator[](std::size_t index) { return at(index); }
+    const T &operator[](std::size_t index) const { return at(index); }
+
+    iterator begin() { return {m_first, 0, 0}; }
+    iterator end() { return {}; }
+    const_iterator begin() const { return {m_first, 0, 0}; }
+    const_iterator end() const { return {}; }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    iterator iteratorAt(std::size_t index)
+    {
+        if (index >= size())
+            return end();
+        const auto location = locate(index);
+        return {location.first, location.second, index};
+    }
+
+    void clear()
+    {
+        m_root.reset();
+        m_first = nullptr;
+        m_leafOf.clear();
+    }
+
+    void insert(std::size_t index, T value)
+    {
+        insertPointer(index, std::make_unique<T>(std::move(value)));
+    }
+
+    template<typename InputIt>
+    void insert(std::size_t index, InputIt first, InputIt last)
+    {
+        for (; first != last; ++first)
+            insert(index++, *first);
+    }
+
+    void push_back(T value) { insert(size(), std::move(value)); }
+
+    // replaces the contents, building a balanced tree in linear time
+    template<typename InputIt>
+    void assign(InputIt first, InputIt last)
+    {
+        std::vector<std::unique_ptr<T>> items;
+        for (; first != last; ++first)
+            items.push_back(std::make_unique<T>(*first));
+        build(std::move(items));
+    }
+
+    void erase(std::size_t index)
+    {
+        assert(index < size());
+        auto [leaf, position] = locate(index);
+        m_leafOf.erase(leaf->items[position].get());
+        leaf->items.erase(leaf->items.begin() + position);
+        for (Node *n = leaf; n; n = n->parent)
+            --n->count;
+        if (leaf->items.empty())
+            removeNode(leaf);
+    }
+
+    // index of the element that element points to, or -1 if it is not part of the sequence
+    std::ptrdiff_t indexOf(const T *element) const
+    {
+        const auto it = m_leafOf.find(element);
+        if (it == m_leafOf.end())
+            return -1;
+        const Leaf *leaf = it->second;
+        std::size_t index = 0;
+        while (leaf->items[index].get() != element)
+            ++index;
+        const Node *child = leaf;
+        for (const Inner *parent = child->parent; parent; child = parent, parent = parent->parent) {
+            for (const auto &sibling : parent->children) {
+                if (sibling.get() == child)
+                    break;
+                index += sibling->count;
+            }
+        }
+        return std::ptrdiff_t(index);
+    }
+
+    // first index in [from, size()) where value could be inserted without violating the order
+    template<typename V, typename Compare>
+    std::size_t lowerBound(const V &value, Compare lessThan, std::size_t from = 0) const
+    {
+        std::size_t count = size() - std::min(from, size());
+        std::size_t first = from;
+        while (count > 0) {
+            const std::size_t step = count / 2;
+            if (lessThan(at(first + step), value)) {
+                first += step + 1;
+                count -= step + 1;
+            } else {
+                count = step;
+            }
+        }
+        return first;
+    }
+
+    // reorders the elements without moving them in memory
+    template<typename Compare>
+    void sort(Compare lessThan)
+    {
+        auto items = takeAll();
+        std::stable_sort(items.begin(),
+                         items.end(),
+                         [&lessThan](const std::unique_ptr<T> &a, const std::unique_ptr<T> &b) {
+                             return lessThan(*a, *b);
+                         });
+        build(std::move(items));
+    }
+
+    template<typename Generator>
+    void shuffle(Generator &&g)
+    {
+        auto items = takeAll();
+        std::shuffle(items.begin(), items.end(), g);
+        build(std::move(items));
+    }
+
+private:
+    std::pair<Leaf *, std::size_t> locate(std::size_t index) const
+    {
+        assert(index < size());
+        Node *node = m_root.get();
+        while (!node->isLeaf) {
+            const auto inner = static_cast<Inner *>(node);
+            for (const auto &child : inner->children) {
+                if (index < child->count) {
+                    node = child.get();
+                    break;
+                }
+                index -= child->count;
+            }
+        }
+        return {static_cast<Leaf *>(node), index};
+    }
+
+    void insertPointer(std::size_t index, std::unique_ptr<T> item)
+    {
+        assert(index <= size());
+        if (!m_root) {
+            auto leaf = std::make_unique<Leaf>();
+            m_first = leaf.get();
+            m_root = std::move(leaf);
+        }
+        Leaf *leaf;
+        std::size_t position;
+        if (index == size()) {
+            // append to the last leaf
+            Node *node = m_root.get();
+            while (!node->isLeaf)
+                node = static_cast<Inner *>(node)->children.back().get();
+            leaf = static_cast<Leaf *>(node);
+            position = leaf->items.size();
+        } else {
+            std::tie(leaf, position) = locate(index);
+        }
+        m_leafOf[item.get()] = leaf;
+        leaf->items.insert(leaf->items.begin() + position, std::move(item));
+        for (Node *n = leaf; n; n = n->parent)
+            ++n->count;
+        if (leaf->items.size() > LeafCapacity)
+            splitLeaf(leaf);
+    }
+
+    void splitLeaf(Leaf *leaf)
+    {
+        auto newLeaf = std::make_unique<Leaf>();
+        const std::size_t half = leaf->items.size() / 2;
+        std::move(leaf->items.begin() + half,
+                  leaf->items.end(),
+                  std::back_inserter(newLeaf->items));
+        leaf->items.erase(leaf->items.begin() + half, leaf->items.end());
+        for (const auto &item : newLeaf->items)
+            m_leafOf[item.get()] = newLeaf.get();
+        leaf->count = leaf->items.size();
+        newLeaf->count = newLeaf->items.size();
+        newLeaf->next = leaf->next;
+        newLeaf->previous = leaf;
+        if (leaf->next)
+            leaf->next->previous = newLeaf.get();
+        leaf->next = newLeaf.get();
+        insertSibling(leaf, std::move(newLeaf));
+    }
+
+    // inserts sibling after node, the counts of all ancestors must already include it
+    void insertSibling(Node *node, std::unique_ptr<Node> sibling)
+    {
+        Inner *parent = node->parent;
+        if (!parent) {
+            auto newRoot = std::make_unique<Inner>();
+            newRoot->count = node->count + sibling->count;
+            node->parent = newRoot.get();
+            sibling->parent = newRoot.get();
+            newRoot->children.push_back(std::move(m_root));
+            newRoot->children.push_back(std::move(sibling));
+            m_root = std::move(newRoot);
+            return;
+        }
+        sibling->parent = parent;
+        const auto it = std::find_if(parent->children.begin(),
+                                     parent->children.end(),
+                                     [node](const std::unique_ptr<Node> &c) {
+                                         return c.get() == node;
+                                     });
+        parent->children.insert(it + 1, std::move(sibling));
+        if (parent->children.size() > NodeCapacity)
+            splitInner(parent);
+    }
+
+    void splitInner(Inner *inner)
+    {
+        auto newInner = std::make_unique<Inner>();
+        const std::size_t half = inner->children.size() / 2;
+        std::move(inner->children.begin() + half,
+                  inner->children.end(),
+                  std::back_inserter(newInner->children));
+        inner->children.erase(inner->children.begin() + half, inner->children.end());
+        for (const auto &child : newInner->children) {
+            child->parent = newInner.get();
+            newInner->count += child->count;
+        }
+        inner->count -= newInner->count;
+        insertSibling(inner, std::move(newInner));
+    }
+
+    // removes an empty node, and parents that become empty by that
+    void removeNode(Node *node)
+    {
+        if (node->isLeaf) {
+            const auto leaf = static_cast<Leaf *>(node);
+            if (leaf->previous)
+                leaf->previous->next = leaf->next;
+            else
+                m_first = leaf->next;
+            if (leaf->next)
+                leaf->next->previous = leaf->previous;
+        }
+        Inner *parent = node->parent;
+        if (!parent) {
+            clear();
+            return;
+        }
+        parent->children.erase(std::find_if(parent->children.begin(),
+                                            parent->children.end(),
+                                            [node](const std::unique_ptr<Node> &c) {
+                                                return c.get() == node;
+                                            }));
+        if (parent->children.empty()) {
+            removeNode(parent);
+            return;
+        }
+        // collapse a root with a single child
+        while (!m_root->isLeaf && static_cast<Inner *>(m_root.get())->children.size() == 1) {
+            std::unique_ptr<Node> child = std::move(
+                static_cast<Inner *>(m_root.get())->children.front());
+            child->parent = nullptr;
+            m_root = std::move(child);
+        }
+    }
+
+    std::vector<std::unique_ptr<T>> takeAll()
+    {
+        std::vector<std::unique_ptr<T>> items;
+        items.reserve(size());
+        for (Leaf *leaf = m_first; leaf; leaf = leaf->next)
+            std::move(leaf->items.begin(), leaf->items.end(), std::back_inserter(items));
+        clear();
+        return items;
+    }
+
+    void build(std::vector<std::unique_ptr<T>> items)
+    {
+        clear();
+        if (items.empty())
+            return;
+        // fill leaves to 3/4 so following insertions do not split immediately
+        const std::size_t leafFill = std::max<std::size_t>(1, LeafCapacity * 3 / 4);
+        std::vector<std::unique_ptr<Node>> level;
+        Leaf *previous = nullptr;
+        for (std::size_t i = 0; i < items.size(); i += leafFill) {
+            auto leaf = std::make_unique<Leaf>();
+            const std::size_t end = std::min(items.size(), i + leafFill);
+            for (std::size_t j = i; j < end; ++j) {
+                m_leafOf[items[j].get()] = leaf.get();
+                leaf->items.push_back(std::move(items[j]));
+            }
+            leaf->count = leaf->items.size();
+            leaf->previous = previous;
+            if (previous)
+                previous->next = leaf.get();
+            else
+                m_first = leaf.get();
+            previous = leaf.get();
+            level.push_back(std::move(leaf));
+        }
+        const std::size_t nodeFill = std::max<std::size_t>(2, NodeCapacity * 3 / 4);
+        while (level.size() > 1) {
+            std::vector<std::unique_ptr<Node>> nextLevel;
+            for (std::size_t i = 0; i < level.size(); i += nodeFill) {
+                auto inner = std::make_unique<Inner>();
+                const std::size_t end = std::min(level.size(), i + nodeFill);
+                for (std::size_t j = i; j < end; ++j) {
+                    level[j]->parent = inner.get();
+                    inner->count += level[j]->count;
+                    inner->children.push_back(std::move(level[j]));
+                }
+                nextLevel.push_back(std::move(inner));
+            }
+            level = std::move(nextLevel);
+        }
+        m_root = std::move(level.front());
+    }
+
+    std::unique_ptr<Node> m_root;
+    Leaf *m_first = nullptr;
+    std::unordered_map<const T *, Leaf *> m_leafOf;
+};
+
+} // namespace Util
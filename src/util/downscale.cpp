@@ -0,0 +1,236 @@
+#include "downscale.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// adds count bytes of a source row to the per channel sums
+using AddRow = void (*)(const uchar *row, int count, quint32 *sums);
+// writes width pixels, each from the sums of factor pixels
+using StoreRow = void (*)(const quint32 *sums, int width, int factor, float scale, uchar *dst);
+
+void addRowScalar(const uchar *row, int count, quint32 *sums)
+{
+    for (int i = 0; i < count; ++i)
+        sums[i] += row[i];
+}
+
+void storeRowScalar(const quint32 *sums, int width, int factor, float scale, uchar *dst)
+{
+    for (int x = 0; x < width; ++x) {
+        const quint32 *pixel = sums + std::size_t(x) * factor * 4;
+        for (int c = 0; c < 4; ++c) {
+            quint32 sum = 0;
+            for (int i = 0; i < factor; ++i)
+                sum += pixel[i * 4 + c];
+            // rounds to nearest even like the SIMD versions
+            dst[x * 4 + c] = uchar(std::lrintf(float(sum) * scale));
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2"))) void addRowSse2(const uchar *row, int count, quint32 *sums)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+        const __m128i low = _mm_unpacklo_epi8(bytes, zero);
+        const __m128i high = _mm_unpackhi_epi8(bytes, zero);
+        const __m128i values[4] = {_mm_unpacklo_epi16(low, zero),
+                                   _mm_unpackhi_epi16(low, zero),
+                                   _mm_unpacklo_epi16(high, zero),
+                                   _mm_unpackhi_epi16(high, zero)};
+        for (int j = 0; j < 4; ++j) {
+            auto s = reinterpret_cast<__m128i *>(sums + i + j * 4);
+            _mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s), values[j]));
+        }
+    }
+    addRowScalar(row + i, count - i, sums + i);
+}
+
+// the 4 channel sums of a pixel fill one register
+__attribute__((target("sse2"))) void storeRowSse2(
+    const quint32 *sums, int width, int factor, float scale, uchar *dst)
+{
+    const __m128 scales = _mm_set1_ps(scale);
+    for (int x = 0; x < width; ++x) {
+        const quint32 *pixel = sums + std::size_t(x) * factor * 4;
+        __m128i sum = _mm_setzero_si128();
+        for (int i = 0; i < factor; ++i) {
+            const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixel + i * 4));
+            sum = _mm_add_epi32(sum, value);
+        }
+        __m128i value = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), scales));
+        value = _mm_packs_epi32(value, value);
+        value = _mm_packus_epi16(value, value);
+        const int result = _mm_cvtsi128_si32(value);
+        std::memcpy(dst + x * 4, &result, 4);
+    }
+}
+
+__attribute__((target("avx2"))) void addRowAvx2(const uchar *row, int count, quint32 *sums)
+{
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        for (int j = 0; j < 32; j += 8) {
+            const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row + i + j));
+            auto s = reinterpret_cast<__m256i *>(sums + i + j);
+            _mm256_storeu_si256(s,
+                                _mm256_add_epi32(_mm256_loadu_si256(s),
+                                                 _mm256_cvtepu8_epi32(bytes)));
+        }
+    }
+    addRowScalar(row + i, count - i, sums + i);
+}
+
+// two pixels per register
+__attribute__((target("avx2"))) void storeRowAvx2(
+    const quint32 *sums, int width, int factor, float scale, uchar *dst)
+{
+    const __m256 scales = _mm256_set1_ps(scale);
+    int x = 0;
+    for (; x + 2 <= width; x += 2) {
+        const quint32 *first = sums + std::size_t(x) * factor * 4;
+        const quint32 *second = first + std::size_t(factor) * 4;
+        __m256i sum = _mm256_setzero_si256();
+        for (int i = 0; i < factor; ++i) {
+            const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first + i * 4));
+            const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(second + i * 4));
+            sum = _mm256_add_epi32(sum,
+                                   _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1));
+        }
+        __m256i value = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(sum), scales));
+        // packing works within the 128 bit lanes, so each lane has its pixel in the low bytes
+        value = _mm256_packs_epi32(value, value);
+        value = _mm256_packus_epi16(value, value);
+        const int low = _mm256_extract_epi32(value, 0);
+        const int high = _mm256_extract_epi32(value, 4);
+        std::memcpy(dst + x * 4, &low, 4);
+        std::memcpy(dst + x * 4 + 4, &high, 4);
+    }
+    if (x < width)
+        storeRowSse2(sums + std::size_t(x) * factor * 4, width - x, factor, scale, dst + x * 4);
+}
+
+#endif
+
+std::pair<AddRow, StoreRow> kernels(Util::DownscaleImplementation implementation)
+{
+#ifdef HAVE_X86_SIMD
+    if (implementation == Util::DownscaleImplementation::Avx2)
+        return {addRowAvx2, storeRowAvx2};
+    if (implementation == Util::DownscaleImplementation::Sse2)
+        return {addRowSse2, storeRowSse2};
+#endif
+    return {addRowScalar, storeRowScalar};
+}
+
+} // namespace
+
+namespace Util {
+
+DownscaleImplementation downscaleImplementation()
+{
+    static const DownscaleImplementation implementation = [] {
+        if (isSupported(DownscaleImplementation::Avx2))
+            return DownscaleImplementation::Avx2;
+        if (isSupported(DownscaleImplementation::Sse2))
+            return DownscaleImplementation::Sse2;
+        return DownscaleImplementation::Scalar;
+    }();
+    return implementation;
+}
+
+bool isSupported(DownscaleImplementation implementation)
+{
+    switch (implementation) {
+    case DownscaleImplementation::Scalar:
+        return true;
+#ifdef HAVE_X86_SIMD
+    case DownscaleImplementation::Sse2:
+        return __builtin_cpu_supports("sse2");
+    case DownscaleImplementation::Avx2:
+        return __builtin_cpu_supports("avx2");
+#else
+    case DownscaleImplementation::Sse2:
+    case DownscaleImplementation::Avx2:
+        return false;
+#endif
+    }
+    return false;
+}
+
+void boxDownscale(const uchar *src,
+                  int width,
+                  int height,
+                  qsizetype srcStride,
+                  int factorX,
+                  int factorY,
+                  uchar *dst,
+                  qsizetype dstStride,
+                  DownscaleImplementation implementation)
+{
+    if (factorX < 1 || factorY < 1)
+        return;
+    if (!isSupported(implementation))
+        implementation = DownscaleImplementation::Scalar;
+    const auto [addRow, storeRow] = kernels(implementation);
+    const int dstWidth = width / factorX;
+    const int dstHeight = height / factorY;
+    const int count = dstWidth * factorX * 4;
+    const float scale = 1.f / float(factorX * factorY);
+    // sums of factorY rows, then averaged over factorX pixels
+    std::vector<quint32> sums(std::size_t(count), 0);
+    for (int y = 0; y < dstHeight; ++y) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int i = 0; i < factorY; ++i)
+            addRow(src + (qsizetype(y) * factorY + i) * srcStride, count, sums.data());
+        storeRow(sums.data(), dstWidth, factorX, scale, dst + qsizetype(y) * dstStride);
+    }
+}
+
+QImage downscaled(const QImage &image, const QSize &size, DownscaleImplementation implementation)
+{
+    if (image.isNull() || size.isEmpty()
+        || (image.width() <= size.width() && image.height() <= size.height())) {
+        return image;
+    }
+    const QSize target = image.size().scaled(size, Qt::KeepAspectRatio).expandedTo({1, 1});
+    const int factorX = image.width() / target.width();
+    const int factorY = image.height() / target.height();
+    const bool isSupportedFormat = image.format() == QImage::Format_RGB32
+                                   || image.format() == QImage::Format_ARGB32
+                                   || image.format() == QImage::Format_ARGB32_Premultiplied;
+    if (!isSupportedFormat || (factorX < 2 && factorY < 2))
+        return image.scaled(target, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    // averaging needs premultiplied alpha, so transparent pixels do not add their color
+    const QImage source = image.format() == QImage::Format_ARGB32
+                              ? image.convertToFormat(QImage::Format_ARGB32_Premultiplied)
+                              : image;
+    QImage reduced(image.width() / factorX, image.height() / factorY, source.format());
+    boxDownscale(source.constBits(),
+                 source.width(),
+                 source.height(),
+                 source.bytesPerLine(),
+                 factorX,
+                 factorY,
+                 reduced.bits(),
+                 reduced.bytesPerLine(),
+                 implementation);
+    if (reduced.size() == target)
+        return reduced;
+    return reduced.scaled(target, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+}
+
+} // namespace Util
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QImage>
+#include <QSize>
+
+namespace Util {
+
+enum class DownscaleImplementation { Scalar, Sse2, Avx2 };
+
+// the fastest implementation that the CPU supports
+DownscaleImplementation downscaleImplementation();
+bool isSupported(DownscaleImplementation implementation);
+
+// Averages blocks of factorX x factorY pixels of an image with 4 8 bit channels per pixel.
+// The result has (width / factorX) x (height / factorY) pixels, remaining pixels at the right
+// and bottom edges are ignored. Strides are in bytes.
+void boxDownscale(const uchar *src,
+                  int width,
+                  int height,
+                  qsizetype srcStride,
+                  int factorX,
+                  int factorY,
+                  uchar *dst,
+                  qsizetype dstStride,
+                  DownscaleImplementation implementation = downscaleImplementation());
+
+// Scales the image down to fit into size, keeping the aspect ratio. RGB32 and ARGB32 images are
+// first reduced by integer factors with an area filter, which leaves less than a factor of 2 for
+// QImage's smooth transformation. Other formats only use QImage.
+QImage downscaled(const QImage &image,
+                  const QSize &size,
+                  DownscaleImplementation implementation = downscaleImplementation());
+
+} // namespace Util
@@ -0,0 +1,441 @@
+#include "exifparser.h"
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+enum Tag : quint16 {
+    NewSubfileType = 0x00fe,
+    ImageWidth = 0x0100,
+    ImageLength = 0x0101,
+    Compression = 0x0103,
+    Make = 0x010f,
+    Model = 0x0110,
+    Orientation = 0x0112,
+    SubIFDs = 0x014a,
+    JpegInterchangeFormat = 0x0201,
+    JpegInterchangeFormatLength = 0x0202,
+    ExifIfdPointer = 0x8769,
+    GpsIfdPointer = 0x8825,
+    IsoSpeedRatings = 0x8827,
+    DateTimeOriginal = 0x9003,
+    FocalLength = 0x920a,
+    PixelXDimension = 0xa002,
+    PixelYDimension = 0xa003,
+    LensModel = 0xa434
+};
+
+// in the GPS IFD
+enum GpsTag : quint16 {
+    GpsLatitudeRef = 0x0001,
+    GpsLatitude = 0x0002,
+    GpsLongitudeRef = 0x0003,
+    GpsLongitude = 0x0004
+};
+
+enum Type : quint16 { Ascii = 2, Short = 3, Long = 4, Rational = 5 };
+
+// bounds checked access to the TIFF structure, offsets are relative to the TIFF header
+class TiffReader
+{
+public:
+    TiffReader(const uchar *data, qint64 size)
+        : m_data(data)
+        , m_size(size)
+    {}
+
+    bool readHeader()
+    {
+        if (m_size < 8)
+            return false;
+        if (m_data[0] == 'I' && m_data[1] == 'I')
+            m_isBigEndian = false;
+        else if (m_data[0] == 'M' && m_data[1] == 'M')
+            m_isBigEndian = true;
+        else
+            return false;
+        // anything else, like BigTIFF, is left to exiv2
+        return u16(2) == 42;
+    }
+
+    std::optional<quint16> u16(qint64 offset) const
+    {
+        if (offset < 0 || offset + 2 > m_size)
+            return {};
+        const uchar *p = m_data + offset;
+        return m_isBigEndian ? quint16((p[0] << 8) | p[1]) : quint16((p[1] << 8) | p[0]);
+    }
+
+    std::optional<quint32> u32(qint64 offset) const
+    {
+        if (offset < 0 || offset + 4 > m_size)
+            return {};
+        const uchar *p = m_data + offset;
+        if (m_isBigEndian)
+            return (quint32(p[0]) << 24) | (quint32(p[1]) << 16) | (quint32(p[2]) << 8) | p[3];
+        return (quint32(p[3]) << 24) | (quint32(p[2]) << 16) | (quint32(p[1]) << 8) | p[0];
+    }
+
+    const uchar *data() const { return m_data; }
+    qint64 size() const { return m_size; }
+
+private:
+    const uchar *m_data;
+    qint64 m_size;
+    bool m_isBigEndian = false;
+};
+
+class Entry
+{
+public:
+    quint16 tag;
+    quint16 type;
+    quint32 count;
+    // offset of the 4 byte value/offset field
+    qint64 valueOffset;
+};
+
+class Ifd
+{
+public:
+    const Entry *find(quint16 tag) const
+    {
+        for (const Entry &entry : entries) {
+            if (entry.tag == tag)
+                return &entry;
+        }
+        return nullptr;
+    }
+
+    std::vector<Entry> entries;
+    quint32 next = 0;
+};
+
+std::optional<Ifd> readIfd(const TiffReader &reader, qint64 offset)
+{
+    const std::optional<quint16> count = reader.u16(offset);
+    if (!count || offset + 2 + *count * 12 + 4 > reader.size())
+        return {};
+    Ifd ifd;
+    ifd.entries.reserve(*count);
+    for (int i = 0; i < *count; ++i) {
+        const qint64 entryOffset = offset + 2 + i * 12;
+        ifd.entries.push_back({*reader.u16(entryOffset),
+                               *reader.u16(entryOffset + 2),
+                               *reader.u32(entryOffset + 4),
+                               entryOffset + 8});
+    }
+    ifd.next = *reader.u32(offset + 2 + *count * 12);
+    return ifd;
+}
+
+// value of a SHORT or LONG entry with count 1
+std::optional<quint32> unsignedValue(const TiffReader &reader, const Entry *entry)
+{
+    if (!entry || entry->count < 1)
+        return {};
+    if (entry->type == Type::Short)
+        return reader.u16(entry->valueOffset);
+    if (entry->type == Type::Long)
+        return reader.u32(entry->valueOffset);
+    return {};
+}
+
+// exiv2 reports the field only if it has the type from the specification, do the same
+std::optional<quint32> typedValue(const TiffReader &reader, const Entry *entry, Type type)
+{
+    if (!entry || entry->type != type)
+        return {};
+    return unsignedValue(reader, entry);
+}
+
+// offset of the data of an entry, which is in the entry itself if it fits
+std::optional<qint64> dataOffset(const TiffReader &reader, const Entry *entry, qint64 size)
+{
+    qint64 offset = entry->valueOffset;
+    if (size > 4) {
+        const std::optional<quint32> valueOffset = reader.u32(entry->valueOffset);
+        if (!valueOffset)
+            return {};
+        offset = *valueOffset;
+    }
+    if (offset + size > reader.size())
+        return {};
+    return offset;
+}
+
+std::optional<QByteArray> asciiValue(const TiffReader &reader, const Entry *entry)
+{
+    if (!entry || entry->type != Type::Ascii || entry->count < 1)
+        return {};
+    const std::optional<qint64> offset = dataOffset(reader, entry, entry->count);
+    if (!offset)
+        return {};
+    const auto value = reinterpret_cast<const char *>(reader.data() + *offset);
+    // the value ends at the first \0
+    const auto end = static_cast<const char *>(std::memchr(value, 0, entry->count));
+    return QByteArray(value, end ? end - value : qsizetype(entry->count));
+}
+
+std::optional<QDateTime> dateTimeValue(const TiffReader &reader, const Entry *entry)
+{
+    const std::optional<QByteArray> value = asciiValue(reader, entry);
+    if (!value)
+        return {};
+    return Util::parseExifDateTime(value->constData(), value->size());
+}
+
+QString stringValue(const TiffReader &reader, const Entry *entry)
+{
+    const std::optional<QByteArray> value = asciiValue(reader, entry);
+    return value ? QString::fromUtf8(*value).trimmed() : QString();
+}
+
+// first value of a SHORT entry with any count
+std::optional<quint16> firstShortValue(const TiffReader &reader, const Entry *entry)
+{
+    if (!entry || entry->type != Type::Short || entry->count < 1)
+        return {};
+    const std::optional<qint64> offset = dataOffset(reader, entry, qint64(entry->count) * 2);
+    return offset ? reader.u16(*offset) : std::nullopt;
+}
+
+std::optional<double> rationalValue(const TiffReader &reader, const Entry *entry, quint32 index = 0)
+{
+    if (!entry || entry->type != Type::Rational || entry->count <= index)
+        return {};
+    const std::optional<qint64> offset = dataOffset(reader, entry, qint64(entry->count) * 8);
+    if (!offset)
+        return {};
+    const std::optional<quint32> numerator = reader.u32(*offset + index * 8);
+    const std::optional<quint32> denominator = reader.u32(*offset + index * 8 + 4);
+    if (!numerator || !denominator || *denominator == 0)
+        return {};
+    return double(*numerator) / *denominator;
+}
+
+// degrees, minutes and seconds, negative for the given reference
+std::optional<double> coordinateValue(const TiffReader &reader,
+                                      const Entry *entry,
+                                      const Entry *refEntry,
+                                      char negativeRef)
+{
+    if (!entry || entry->count != 3)
+        return {};
+    const std::optional<double> degrees = rationalValue(reader, entry, 0);
+    const std::optional<double> minutes = rationalValue(reader, entry, 1);
+    const std::optional<double> seconds = rationalValue(reader, entry, 2);
+    const std::optional<QByteArray> ref = asciiValue(reader, refEntry);
+    if (!degrees || !minutes || !seconds || !ref)
+        return {};
+    const double value = *degrees + *minutes / 60 + *seconds / 3600;
+    return ref->startsWith(negativeRef) ? -value : value;
+}
+
+std::optional<Util::GeoPosition> positionValue(const TiffReader &reader, const Ifd &gpsIfd)
+{
+    const std::optional<double> latitude = coordinateValue(reader,
+                                                           gpsIfd.find(GpsTag::GpsLatitude),
+                                                           gpsIfd.find(GpsTag::GpsLatitudeRef),
+                                                           'S');
+    const std::optional<double> longitude = coordinateValue(reader,
+                                                            gpsIfd.find(GpsTag::GpsLongitude),
+                                                            gpsIfd.find(GpsTag::GpsLongitudeRef),
+                                                            'W');
+    if (!latitude || !longitude || qAbs(*latitude) > 90 || qAbs(*longitude) > 180)
+        return {};
+    return Util::GeoPosition{*latitude, *longitude};
+}
+
+bool isValidOrientation(quint32 value)
+{
+    return value >= 1 && value <= 8;
+}
+
+// Reads the fields from the TIFF structure at tiffOffset in data.
+// Returns false if something needs exiv2.
+bool readTiff(const QByteArray &data,
+              qint64 tiffOffset,
+              qint64 tiffSize,
+              bool isTiffFile,
+              std::optional<qint64> fileSize,
+              Util::ExifFields &fields)
+{
+    TiffReader reader(reinterpret_cast<const uchar *>(data.constData()) + tiffOffset, tiffSize);
+    if (!reader.readHeader())
+        return false;
+    const std::optional<quint32> ifd0Offset = reader.u32(4);
+    if (!ifd0Offset)
+        return false;
+    const std::optional<Ifd> ifd0 = readIfd(reader, *ifd0Offset);
+    if (!ifd0)
+        return false;
+
+    if (const auto orientation = typedValue(reader, ifd0->find(Tag::Orientation), Type::Short)) {
+        if (isValidOrientation(*orientation))
+            fields.orientation = Util::Orientation(*orientation);
+    }
+
+    fields.make = stringValue(reader, ifd0->find(Tag::Make));
+    fields.model = stringValue(reader, ifd0->find(Tag::Model));
+
+    if (isTiffFile) {
+        // raw formats and multi-page files have their main image somewhere else
+        const Entry *subfileType = ifd0->find(Tag::NewSubfileType);
+        if (ifd0->find(Tag::SubIFDs)
+            || (subfileType && unsignedValue(reader, subfileType).value_or(1) != 0)) {
+            return false;
+        }
+        const auto width = unsignedValue(reader, ifd0->find(Tag::ImageWidth));
+        const auto height = unsignedValue(reader, ifd0->find(Tag::ImageLength));
+        if (width && height && *width > 0 && *height > 0)
+            fields.pixelDimensions = QSize(int(*width), int(*height));
+    }
+
+    if (const Entry *exifPointer = ifd0->find(Tag::ExifIfdPointer)) {
+        const std::optional<quint32> exifOffset = unsignedValue(reader, exifPointer);
+        const std::optional<Ifd> exifIfd = exifOffset ? readIfd(reader, *exifOffset) : std::nullopt;
+        if (!exifIfd)
+            return false;
+        fields.created = dateTimeValue(reader, exifIfd->find(Tag::DateTimeOriginal));
+        fields.lens = stringValue(reader, exifIfd->find(Tag::LensModel));
+        fields.iso = firstShortValue(reader, exifIfd->find(Tag::IsoSpeedRatings));
+        fields.focalLength = rationalValue(reader, exifIfd->find(Tag::FocalLength));
+        const auto x = typedValue(reader, exifIfd->find(Tag::PixelXDimension), Type::Long);
+        const auto y = typedValue(reader, exifIfd->find(Tag::PixelYDimension), Type::Long);
+        if (x && y && *x > 0 && *y > 0)
+            fields.pixelDimensions = QSize(int(*x), int(*y));
+    }
+
+    if (const Entry *gpsPointer = ifd0->find(Tag::GpsIfdPointer)) {
+        const std::optional<quint32> gpsOffset = unsignedValue(reader, gpsPointer);
+        const std::optional<Ifd> gpsIfd = gpsOffset ? readIfd(reader, *gpsOffset) : std::nullopt;
+        if (!gpsIfd)
+            return false;
+        fields.position = positionValue(reader, *gpsIfd);
+    }
+
+    if (ifd0->next == 0)
+        return true;
+    const std::optional<Ifd> ifd1 = readIfd(reader, ifd0->next);
+    if (!ifd1)
+        return false;
+    const Entry *compression = ifd1->find(Tag::Compression);
+    const auto thumbnailOffset = unsignedValue(reader, ifd1->find(Tag::JpegInterchangeFormat));
+    const auto thumbnailSize = unsignedValue(reader, ifd1->find(Tag::JpegInterchangeFormatLength));
+    // only JPEG thumbnails, uncompressed ones are left to exiv2
+    if (compression && unsignedValue(reader, compression).value_or(0) != 6)
+        return false;
+    if (thumbnailOffset && thumbnailSize && *thumbnailSize > 0) {
+        Util::EmbeddedThumbnail thumbnail;
+        thumbnail.offset = tiffOffset + *thumbnailOffset;
+        thumbnail.size = *thumbnailSize;
+        if (!fileSize || thumbnail.offset + thumbnail.size <= *fileSize)
+            fields.thumbnail = thumbnail;
+    }
+    return true;
+}
+
+bool isStartOfFrame(uchar marker)
+{
+    return marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc;
+}
+
+std::optional<Util::ExifFields> parseJpeg(const QByteArray &data, std::optional<qint64> fileSize)
+{
+    const auto d = reinterpret_cast<const uchar *>(data.constData());
+    const qint64 size = data.size();
+    const auto u16 = [d](qint64 offset) { return quint16((d[offset] << 8) | d[offset + 1]); };
+    qint64 exifStart = -1;
+    qint64 exifSize = 0;
+    std::optional<QSize> frameSize;
+    qint64 pos = 2;
+    while (!frameSize) {
+        if (pos >= size || d[pos] != 0xff)
+            return {};
+        while (pos < size && d[pos] == 0xff)
+            ++pos;
+        if (pos >= size)
+            return {};
+        const uchar marker = d[pos++];
+        // markers without segment
+        if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8))
+            continue;
+        // start of scan or end of image before the frame header
+        if (marker == 0xda || marker == 0xd9)
+            return {};
+        if (pos + 2 > size)
+            return {};
+        const qint64 length = u16(pos);
+        const qint64 segmentStart = pos + 2;
+        const qint64 segmentEnd = pos + length;
+        if (length < 2 || segmentEnd > size)
+            return {};
+        if (marker == 0xe1 && exifStart < 0 && length >= 8
+            && std::memcmp(d + segmentStart, "Exif\0\0", 6) == 0) {
+            exifStart = segmentStart + 6;
+            exifSize = segmentEnd - exifStart;
+        } else if (isStartOfFrame(marker)) {
+            if (length < 7)
+                return {};
+            frameSize = QSize(u16(segmentStart + 3), u16(segmentStart + 1));
+        }
+        pos = segmentEnd;
+    }
+    Util::ExifFields fields;
+    if (exifStart >= 0 && !readTiff(data, exifStart, exifSize, false, fileSize, fields))
+        return {};
+    if (!fields.pixelDimensions && !frameSize->isEmpty())
+        fields.pixelDimensions = frameSize;
+    return fields;
+}
+
+std::optional<Util::ExifFields> parseTiff(const QByteArray &data, std::optional<qint64> fileSize)
+{
+    // Canon raw files are TIFF based, but exiv2 handles them differently
+    if (data.size() >= 10 && data.at(8) == 'C' && data.at(9) == 'R')
+        return {};
+    Util::ExifFields fields;
+    if (!readTiff(data, 0, data.size(), true, fileSize, fields))
+        return {};
+    return fields;
+}
+
+} // namespace
+
+namespace Util {
+
+std::optional<ExifFields> parseExif(const QByteArray &data, std::optional<qint64> fileSize)
+{
+    if (data.startsWith("\xff\xd8"))
+        return parseJpeg(data, fileSize);
+    if (data.startsWith(QByteArray("II*\0", 4)) || data.startsWith(QByteArray("MM\0*", 4)))
+        return parseTiff(data, fileSize);
+    return {};
+}
+
+std::optional<QDateTime> parseExifDateTime(const char *data, qsizetype size)
+{
+    if (size != 19 || data[4] != ':' || data[7] != ':' || data[10] != ' ' || data[13] != ':'
+        || data[16] != ':') {
+        return {};
+    }
+    const auto number = [data](int pos, int length) {
+        int value = 0;
+        for (int i = pos; i < pos + length; ++i) {
+            if (data[i] < '0' || data[i] > '9')
+                return -1;
+            value = value * 10 + (data[i] - '0');
+        }
+        return value;
+    };
+    const int year = number(0, 4);
+    const QDate date(year, number(5, 2), number(8, 2));
+    const QTime time(number(11, 2), number(14, 2), number(17, 2));
+    if (year < 0 || !date.isValid() || !time.isValid())
+        return {};
+    return QDateTime(date, time);
+}
+
+} // namespace Util
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "metadatautil.h"
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QSize>
+#include <QString>
+
+#include <optional>
+
+namespace Util {
+
+// the fields of the Exif data that are needed for scanning directories
+class ExifFields
+{
+public:
+    std::optional<QDateTime> created;
+    Orientation orientation = Orientation::Normal;
+    // from the Exif IFD if available, from the image otherwise, not rotated
+    std::optional<QSize> pixelDimensions;
+    std::optional<EmbeddedThumbnail> thumbnail;
+    QString make;
+    QString model;
+    QString lens;
+    std::optional<int> iso;
+    std::optional<double> focalLength;
+    std::optional<GeoPosition> position;
+};
+
+// Reads the fields directly from the start of a JPEG or (plain) TIFF file.
+// Returns std::nullopt if the data is neither, if anything needed is not in data, or if the layout
+// is unusual. exiv2 must be used in that case.
+std::optional<ExifFields> parseExif(const QByteArray &data, std::optional<qint64> fileSize);
+
+// Parses the "yyyy:MM:dd hh:mm:ss" format of Exif dates.
+std::optional<QDateTime> parseExifDateTime(const char *data, qsizetype size);
+
+} // namespace Util
@@ -0,0 +1,274 @@
+#include "facetindex.h"
+
+#include "metadatautil.h"
+
+#include <algorithm>
+#include <numeric>
+
+// focal lengths are compared with the precision that is usually shown
+const double kFocalLengthTolerance = 0.05;
+
+static std::pair<QString, std::optional<double>> facetValue(const Util::MetaData &metaData,
+                                                            Util::Facet facet)
+{
+    switch (facet) {
+    case Util::Facet::Camera:
+        return {metaData.camera, {}};
+    case Util::Facet::Lens:
+        return {metaData.lens, {}};
+    case Util::Facet::Iso:
+        if (metaData.iso)
+            return {QString::number(*metaData.iso), double(*metaData.iso)};
+        break;
+    case Util::Facet::FocalLength:
+        if (metaData.focalLength)
+            return {QString::number(*metaData.focalLength, 'g', 4), *metaData.focalLength};
+        break;
+    }
+    return {};
+}
+
+static bool isNumeric(Util::Facet facet)
+{
+    return facet == Util::Facet::Iso || facet == Util::Facet::FocalLength;
+}
+
+static const std::vector<std::pair<QString, Util::Facet>> &facetPrefixes()
+{
+    using Util::Facet;
+    static const std::vector<std::pair<QString, Facet>> prefixes = {{"camera:", Facet::Camera},
+                                                                    {"lens:", Facet::Lens},
+                                                                    {"iso:", Facet::Iso},
+                                                                    {"focal:", Facet::FocalLength}};
+    return prefixes;
+}
+
+namespace Util {
+
+bool FacetCondition::matches(const QString &label, std::optional<double> number) const
+{
+    if (!isNumeric(facet))
+        return !label.isEmpty() && label.contains(text, Qt::CaseInsensitive);
+    if (!number)
+        return false;
+    if (min && (isMinExclusive ? *number <= *min : *number < *min))
+        return false;
+    if (max && (isMaxExclusive ? *number >= *max : *number > *max))
+        return false;
+    return true;
+}
+
+QString facetPrefix(Facet facet)
+{
+    const auto &prefixes = facetPrefixes();
+    const auto prefix = std::find_if(prefixes.cbegin(), prefixes.cend(), [facet](const auto &p) {
+        return p.second == facet;
+    });
+    return prefix == prefixes.cend() ? QString() : prefix->first;
+}
+
+std::optional<FacetCondition> parseFacetCondition(const QString &term)
+{
+    const auto &prefixes = facetPrefixes();
+    const auto prefix = std::find_if(prefixes.cbegin(), prefixes.cend(), [term](const auto &p) {
+        return term.startsWith(p.first, Qt::CaseInsensitive);
+    });
+    if (prefix == prefixes.cend())
+        return {};
+    FacetCondition condition;
+    condition.facet = prefix->second;
+    const QString value = term.mid(prefix->first.size());
+    if (value.isEmpty())
+        return {};
+    if (!isNumeric(condition.facet)) {
+        condition.text = value;
+        return condition;
+    }
+    const auto toNumber = [](const QString &s) -> std::optional<double> {
+        bool ok;
+        const double number = s.toDouble(&ok);
+        return ok ? std::make_optional(number) : std::nullopt;
+    };
+    if (value.startsWith('>') || value.startsWith('<')) {
+        const bool isOrEqual = value.size() > 1 && value.at(1) == '=';
+        const std::optional<double> number = toNumber(value.mid(isOrEqual ? 2 : 1));
+        if (!number)
+            return {};
+        if (value.startsWith('>')) {
+            condition.min = number;
+            condition.isMinExclusive = !isOrEqual;
+        } else {
+            condition.max = number;
+            condition.isMaxExclusive = !isOrEqual;
+        }
+        return condition;
+    }
+    const qsizetype dash = value.indexOf('-', 1);
+    if (dash > 0) {
+        condition.min = toNumber(value.left(dash));
+        condition.max = toNumber(value.mid(dash + 1));
+        if (!condition.min || !condition.max)
+            return {};
+        return condition;
+    }
+    const std::optional<double> number = toNumber(value);
+    if (!number)
+        return {};
+    const double tolerance = condition.facet == Facet::FocalLength ? kFocalLengthTolerance : 0;
+    condition.min = *number - tolerance;
+    condition.max = *number + tolerance;
+    return condition;
+}
+
+bool FacetQuery::isEmpty() const
+{
+    return conditions.empty() && areas.empty();
+}
+
+bool FacetQuery::matches(const MetaData &metaData) const
+{
+    const bool isInAreas = std::all_of(areas.cbegin(),
+                                       areas.cend(),
+                                       [&metaData](const GeoArea &area) {
+                                           return metaData.position
+                                                  && area.contains(*metaData.position);
+                                       });
+    return isInAreas
+           && std::all_of(conditions.cbegin(),
+                          conditions.cend(),
+                          [&metaData](const FacetCondition &condition) {
+                              const auto value = facetValue(metaData, condition.facet);
+                              return condition.matches(value.first, value.second);
+                          });
+}
+
+bool FacetQuery::operator==(const FacetQuery &other) const
+{
+    const auto isSame = [](const FacetCondition &a, const FacetCondition &b) {
+        return a.facet == b.facet && a.text == b.text && a.min == b.min && a.max == b.max
+               && a.isMinExclusive == b.isMinExclusive && a.isMaxExclusive == b.isMaxExclusive;
+    };
+    return areas == other.areas
+           && std::equal(conditions.cbegin(),
+                         conditions.cend(),
+                         other.conditions.cbegin(),
+                         other.conditions.cend(),
+                         isSame);
+}
+
+FacetIndex::Column::Column()
+    : labels({QString()})
+    , numbers({std::nullopt})
+    , counts({0})
+{}
+
+quint32 FacetIndex::Column::code(const QString &label, std::optional<double> number)
+{
+    if (label.isEmpty())
+        return 0;
+    const auto it = codes.constFind(label);
+    if (it != codes.cend())
+        return *it;
+    const auto newCode = quint32(labels.size());
+    labels.append(label);
+    numbers.push_back(number);
+    counts.push_back(0);
+    codes.insert(label, newCode);
+    return newCode;
+}
+
+FacetIndex::Id FacetIndex::add(const MetaData &metaData)
+{
+    for (std::size_t f = 0; f < m_columns.size(); ++f) {
+        Column &column = m_columns.at(f);
+        const auto value = facetValue(metaData, Facet(f));
+        const quint32 code = column.code(value.first, value.second);
+        column.values.push_back(code);
+        ++column.counts.at(code);
+    }
+    m_isRemoved.push_back(false);
+    const auto id = Id(m_isRemoved.size() - 1);
+    if (metaData.position)
+        m_positions.insert(id, *metaData.position);
+    return id;
+}
+
+void FacetIndex::remove(Id id)
+{
+    if (id >= m_isRemoved.size() || m_isRemoved.at(id))
+        return;
+    m_isRemoved.at(id) = true;
+    for (Column &column : m_columns)
+        --column.counts.at(column.values.at(id));
+    m_positions.remove(id);
+}
+
+void FacetIndex::clear()
+{
+    m_columns = {};
+    m_positions.clear();
+    m_isRemoved.clear();
+}
+
+std::vector<bool> FacetIndex::match(const FacetQuery &query) const
+{
+    std::vector<bool> result(m_isRemoved.size());
+    result.flip();
+    for (std::size_t id = 0; id < m_isRemoved.size(); ++id) {
+        if (m_isRemoved.at(id))
+            result.at(id) = false;
+    }
+    for (const FacetCondition &condition : query.conditions) {
+        const Column &column = m_columns.at(std::size_t(condition.facet));
+        // the condition for each distinct value
+        std::vector<char> codeMatches(column.labels.size());
+        for (std::size_t code = 1; code < codeMatches.size(); ++code)
+            codeMatches[code] = condition.matches(column.labels.at(code), column.numbers.at(code));
+        const quint32 *values = column.values.data();
+        for (std::size_t id = 0; id < result.size(); ++id) {
+            if (!codeMatches[values[id]])
+                result[id] = false;
+        }
+    }
+    for (const GeoArea &area : query.areas) {
+        std::vector<bool> isInArea(result.size());
+        m_positions.match(area, isInArea);
+        for (std::size_t id = 0; id < result.size(); ++id)
+            result[id] = result[id] && isInArea[id];
+    }
+    return result;
+}
+
+QList<FacetCount> FacetIndex::counts(Facet facet, const std::vector<bool> *matches) const
+{
+    const Column &column = m_columns.at(std::size_t(facet));
+    std::vector<int> counts;
+    if (matches) {
+        counts.resize(column.labels.size());
+        for (std::size_t id = 0; id < column.values.size() && id < matches->size(); ++id) {
+            if ((*matches)[id])
+                ++counts[column.values[id]];
+        }
+    } else {
+        counts = column.counts;
+    }
+    std::vector<quint32> codes(column.labels.size());
+    std::iota(codes.begin(), codes.end(), 0);
+    if (isNumeric(facet)) {
+        std::sort(codes.begin() + 1, codes.end(), [&column](quint32 a, quint32 b) {
+            return column.numbers.at(a) < column.numbers.at(b);
+        });
+    } else {
+        std::sort(codes.begin() + 1, codes.end(), [&column](quint32 a, quint32 b) {
+            return column.labels.at(a).compare(column.labels.at(b), Qt::CaseInsensitive) < 0;
+        });
+    }
+    QList<FacetCount> result;
+    for (auto it = codes.cbegin() + 1; it != codes.cend(); ++it) {
+        if (counts.at(*it) > 0)
+            result.append({column.labels.at(*it), counts.at(*it)});
+    }
+    return result;
+}
+
+} // namespace Util
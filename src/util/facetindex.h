@@ -0,0 +1,101 @@
+#pragma once
+
+#include "geoindex.h"
+
+#include <QHash>
+#include <QList>
+#include <QString>
+
+#include <array>
+#include <optional>
+#include <vector>
+
+namespace Util {
+
+class MetaData;
+
+enum class Facet { Camera, Lens, Iso, FocalLength };
+
+// A condition on one facet. Text facets match a case insensitive part of the value, numeric
+// facets a range of values.
+class FacetCondition
+{
+public:
+    Facet facet = Facet::Camera;
+    QString text;
+    std::optional<double> min;
+    std::optional<double> max;
+    bool isMinExclusive = false;
+    bool isMaxExclusive = false;
+
+    bool matches(const QString &label, std::optional<double> number) const;
+};
+
+// "camera:", "lens:", "iso:" or "focal:", which starts the conditions on the facet in filters
+QString facetPrefix(Facet facet);
+
+// Parses "camera:x-t4", "lens:23mm", "iso:>3200", "iso:<=800", "focal:23", "focal:20-35".
+// Returns std::nullopt for terms that are not facet conditions.
+std::optional<FacetCondition> parseFacetCondition(const QString &term);
+
+// all conditions must match, and the position must be inside of all areas
+class FacetQuery
+{
+public:
+    std::vector<FacetCondition> conditions;
+    std::vector<GeoArea> areas;
+
+    bool isEmpty() const;
+    bool matches(const MetaData &metaData) const;
+    bool operator==(const FacetQuery &other) const;
+};
+
+class FacetCount
+{
+public:
+    QString value;
+    int count = 0;
+};
+
+// Columnar index over the facets of items, which can be added one by one.
+// Each facet is a column of value codes with a dictionary, so queries evaluate the conditions
+// once per distinct value and then only compare codes. Positions are in a GeoIndex.
+// Not thread-safe.
+class FacetIndex
+{
+public:
+    using Id = quint32;
+
+    Id add(const MetaData &metaData);
+    void remove(Id id);
+    void clear();
+
+    // one entry per id, true for the items that match
+    std::vector<bool> match(const FacetQuery &query) const;
+    // number of items per value of the facet, sorted by value
+    // only counts the items in matches if given
+    QList<FacetCount> counts(Facet facet, const std::vector<bool> *matches = nullptr) const;
+
+private:
+    class Column
+    {
+    public:
+        Column();
+
+        quint32 code(const QString &label, std::optional<double> number);
+
+        // code 0 is for unknown values
+        QList<QString> labels;
+        std::vector<std::optional<double>> numbers;
+        std::vector<int> counts;
+        QHash<QString, quint32> codes;
+        // code per id
+        std::vector<quint32> values;
+    };
+
+    std::array<Column, 4> m_columns;
+    GeoIndex m_positions;
+    std::vector<bool> m_isRemoved;
+};
+
+} // namespace Util
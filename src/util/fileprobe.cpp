@@ -0,0 +1,92 @@
+#include "fileprobe.h"
+
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/sysmacros.h>
+#endif
+
+static QDateTime toDateTime(qint64 secs, qint64 nsecs)
+{
+    return QDateTime::fromMSecsSinceEpoch(secs * 1000 + nsecs / 1000000);
+}
+
+namespace Util {
+
+#ifdef Q_OS_LINUX
+FileStat fileStat(const struct statx &stx)
+{
+    FileStat stat;
+    stat.size = qint64(stx.stx_size);
+    stat.lastModified = toDateTime(stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec);
+    if (stx.stx_mask & STATX_BTIME)
+        stat.birthTime = toDateTime(stx.stx_btime.tv_sec, stx.stx_btime.tv_nsec);
+    stat.changeTime = toDateTime(stx.stx_ctime.tv_sec, stx.stx_ctime.tv_nsec);
+    stat.inode = stx.stx_ino;
+    stat.device = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    return stat;
+}
+#endif
+
+std::optional<FileStat> statFile(const QString &filePath)
+{
+    const QByteArray path = QFile::encodeName(filePath);
+#if defined(Q_OS_LINUX)
+    struct statx stx;
+    if (statx(AT_FDCWD, path.constData(), 0, STATX_BASIC_STATS | STATX_BTIME, &stx) != 0)
+        return {};
+    return fileStat(stx);
+#elif defined(Q_OS_MACOS)
+    struct stat st;
+    if (stat(path.constData(), &st) != 0)
+        return {};
+    FileStat result;
+    result.size = st.st_size;
+    result.lastModified = toDateTime(st.st_mtimespec.tv_sec, st.st_mtimespec.tv_nsec);
+    result.birthTime = toDateTime(st.st_birthtimespec.tv_sec, st.st_birthtimespec.tv_nsec);
+    result.changeTime = toDateTime(st.st_ctimespec.tv_sec, st.st_ctimespec.tv_nsec);
+    result.inode = st.st_ino;
+    result.device = quint64(st.st_dev);
+    return result;
+#else
+    Q_UNUSED(path)
+    const QFileInfo fi(filePath);
+    if (!fi.exists())
+        return {};
+    FileStat result;
+    result.size = fi.size();
+    result.lastModified = fi.lastModified();
+    result.birthTime = fi.birthTime();
+    result.changeTime = fi.metadataChangeTime();
+    return result;
+#endif
+}
+
+std::vector<FileProbe> probeFilesSynchronously(const QStringList &filePaths, qsizetype headerSize)
+{
+    std::vector<FileProbe> probes(filePaths.size());
+    for (qsizetype i = 0; i < filePaths.size(); ++i) {
+        FileProbe &probe = probes[i];
+        probe.stat = statFile(filePaths.at(i));
+        if (headerSize > 0 && probe.stat) {
+            QFile file(filePaths.at(i));
+            if (file.open(QIODevice::ReadOnly))
+                probe.header = file.read(headerSize);
+        }
+    }
+    return probes;
+}
+
+#ifndef HAVE_LIBURING
+std::vector<FileProbe> probeFiles(const QStringList &filePaths, const char *, qsizetype headerSize)
+{
+    return probeFilesSynchronously(filePaths, headerSize);
+}
+#endif
+
+} // namespace Util
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QStringList>
+
+#include <optional>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+struct statx;
+#endif
+
+namespace Util {
+
+class FileStat
+{
+public:
+    qint64 size = 0;
+    QDateTime lastModified;
+    QDateTime birthTime;
+    QDateTime changeTime;
+    quint64 inode = 0;
+    quint64 device = 0;
+};
+
+class FileProbe
+{
+public:
+    std::optional<FileStat> stat;
+    // std::nullopt if the attribute could not be read, empty if the file does not have it
+    std::optional<QByteArray> attribute;
+    // first bytes of the file, empty if it could not be read
+    QByteArray header;
+};
+
+// One stat call that gets size, times and identity of the file, following symlinks.
+std::optional<FileStat> statFile(const QString &filePath);
+#ifdef Q_OS_LINUX
+FileStat fileStat(const struct statx &stx);
+#endif
+
+// Reads stat data, the extended attribute with the given name, and the first headerSize bytes
+// for all files in one batch, in the order of filePaths.
+// Uses batched I/O where available, and individual calls otherwise. The attribute is only read
+// with batched I/O, it is std::nullopt otherwise.
+std::vector<FileProbe> probeFiles(const QStringList &filePaths,
+                                  const char *attributeName,
+                                  qsizetype headerSize);
+// stat and header with individual calls
+std::vector<FileProbe> probeFilesSynchronously(const QStringList &filePaths, qsizetype headerSize);
+
+} // namespace Util
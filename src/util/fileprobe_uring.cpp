@@ -0,0 +1,225 @@
+#include "fileprobe.h"
+
+#include <QFile>
+
+#include <liburing.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <deque>
+
+namespace {
+
+const unsigned kRingSize = 64;
+const unsigned kMaxAttributeSize = 4096;
+
+enum class Op : quint64 { Statx, GetXattr, Open, Read, Close };
+
+class Ring
+{
+public:
+    Ring()
+    {
+        m_isValid = io_uring_queue_init(kRingSize, &m_ring, 0) == 0;
+        if (!m_isValid)
+            return;
+        io_uring_probe *probe = io_uring_get_probe_ring(&m_ring);
+        if (!probe) {
+            io_uring_queue_exit(&m_ring);
+            m_isValid = false;
+            return;
+        }
+        m_hasGetXattr = io_uring_opcode_supported(probe, IORING_OP_GETXATTR);
+        m_isValid = io_uring_opcode_supported(probe, IORING_OP_STATX)
+                    && io_uring_opcode_supported(probe, IORING_OP_OPENAT)
+                    && io_uring_opcode_supported(probe, IORING_OP_READ)
+                    && io_uring_opcode_supported(probe, IORING_OP_CLOSE);
+        io_uring_free_probe(probe);
+        if (!m_isValid)
+            io_uring_queue_exit(&m_ring);
+    }
+
+    ~Ring()
+    {
+        if (m_isValid)
+            io_uring_queue_exit(&m_ring);
+    }
+
+    void invalidate()
+    {
+        if (m_isValid)
+            io_uring_queue_exit(&m_ring);
+        m_isValid = false;
+    }
+
+    bool isValid() const { return m_isValid; }
+    bool hasGetXattr() const { return m_hasGetXattr; }
+    io_uring *get() { return &m_ring; }
+
+private:
+    io_uring m_ring;
+    bool m_isValid = false;
+    bool m_hasGetXattr = false;
+};
+
+// rings are cheap to keep around but not thread safe, so use one per worker thread
+Ring &threadRing()
+{
+    thread_local Ring ring;
+    return ring;
+}
+
+class FileState
+{
+public:
+    QByteArray path;
+    struct statx stx;
+    QByteArray attribute;
+    int fd = -1;
+};
+
+quint64 userData(Op op, std::size_t index)
+{
+    return (quint64(index) << 3) | quint64(op);
+}
+
+} // namespace
+
+namespace Util {
+
+std::vector<FileProbe> probeFiles(const QStringList &filePaths,
+                                  const char *attributeName,
+                                  qsizetype headerSize)
+{
+    Ring &ring = threadRing();
+    if (!ring.isValid())
+        return probeFilesSynchronously(filePaths, headerSize);
+
+    std::vector<FileState> states(filePaths.size());
+    std::vector<FileProbe> probes(filePaths.size());
+    std::deque<std::pair<Op, std::size_t>> queue;
+    for (std::size_t i = 0; i < states.size(); ++i) {
+        states[i].path = QFile::encodeName(filePaths.at(i));
+        queue.push_back({Op::Statx, i});
+        if (ring.hasGetXattr())
+            queue.push_back({Op::GetXattr, i});
+        if (headerSize > 0)
+            queue.push_back({Op::Open, i});
+    }
+
+    const auto prepare = [&](io_uring_sqe *sqe, Op op, std::size_t index) {
+        FileState &state = states[index];
+        FileProbe &probe = probes[index];
+        switch (op) {
+        case Op::Statx:
+            io_uring_prep_statx(sqe,
+                                AT_FDCWD,
+                                state.path.constData(),
+                                0,
+                                STATX_BASIC_STATS | STATX_BTIME,
+                                &state.stx);
+            break;
+        case Op::GetXattr:
+            state.attribute.resize(kMaxAttributeSize);
+            io_uring_prep_getxattr(sqe,
+                                   attributeName,
+                                   state.attribute.data(),
+                                   state.path.constData(),
+                                   kMaxAttributeSize);
+            break;
+        case Op::Open:
+            io_uring_prep_openat(sqe, AT_FDCWD, state.path.constData(), O_RDONLY | O_CLOEXEC, 0);
+            break;
+        case Op::Read:
+            probe.header.resize(headerSize);
+            io_uring_prep_read(sqe, state.fd, probe.header.data(), unsigned(headerSize), 0);
+            break;
+        case Op::Close:
+            io_uring_prep_close(sqe, state.fd);
+            break;
+        }
+        io_uring_sqe_set_data64(sqe, userData(op, index));
+    };
+
+    const auto complete = [&](quint64 data, int result) {
+        const auto op = Op(data & 0x7);
+        const std::size_t index = data >> 3;
+        FileState &state = states[index];
+        FileProbe &probe = probes[index];
+        switch (op) {
+        case Op::Statx:
+            if (result == 0)
+                probe.stat = Util::fileStat(state.stx);
+            break;
+        case Op::GetXattr:
+            if (result >= 0) {
+                state.attribute.resize(result);
+                probe.attribute = state.attribute;
+            } else if (result == -ENODATA || result == -ENOTSUP || result == -EOPNOTSUPP) {
+                probe.attribute = QByteArray();
+            }
+            // other errors (like ERANGE for big values) leave it to the caller
+            break;
+        case Op::Open:
+            if (result >= 0) {
+                state.fd = result;
+                queue.push_back({Op::Read, index});
+            }
+            break;
+        case Op::Read:
+            probe.header.resize(result >= 0 ? result : 0);
+            queue.push_back({Op::Close, index});
+            break;
+        case Op::Close:
+            state.fd = -1;
+            break;
+        }
+    };
+
+    io_uring *r = ring.get();
+    unsigned inFlight = 0;
+    while (!queue.empty() || inFlight > 0) {
+        while (!queue.empty() && inFlight < kRingSize) {
+            io_uring_sqe *sqe = io_uring_get_sqe(r);
+            if (!sqe)
+                break;
+            prepare(sqe, queue.front().first, queue.front().second);
+            queue.pop_front();
+            ++inFlight;
+        }
+        const int submitted = io_uring_submit_and_wait(r, 1);
+        if (submitted < 0 && submitted != -EINTR && submitted != -EAGAIN
+            && submitted != -EBUSY) {
+            // cannot continue, but the kernel may still write into our buffers
+            __kernel_timespec timeout{1, 0};
+            io_uring_cqe *cqe = nullptr;
+            while (inFlight > 0 && io_uring_wait_cqe_timeout(r, &cqe, &timeout) == 0) {
+                complete(io_uring_cqe_get_data64(cqe), cqe->res);
+                io_uring_cqe_seen(r, cqe);
+                --inFlight;
+            }
+            for (const FileState &state : states) {
+                if (state.fd >= 0)
+                    ::close(state.fd);
+            }
+            // use the synchronous fallback from now on
+            ring.invalidate();
+            return probeFilesSynchronously(filePaths, headerSize);
+        }
+        unsigned head;
+        unsigned count = 0;
+        io_uring_cqe *cqe;
+        io_uring_for_each_cqe(r, head, cqe) {
+            ++count;
+            complete(io_uring_cqe_get_data64(cqe), cqe->res);
+        }
+        io_uring_cq_advance(r, count);
+        inFlight -= count;
+    }
+    return probes;
+}
+
+} // namespace Util
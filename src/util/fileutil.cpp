@@ -18,6 +18,40 @@ QString resolveSymlinks(const QString &filePath)
     return fi.filePath();
 }
 
+QString SymlinkResolver::resolve(const QString &filePath, bool isSymLink)
+{
+    if (!isSymLink)
+        return filePath;
+    QFileInfo fi(filePath);
+    int count = 0;
+    static const int maxCount = 10;
+    while (++count <= maxCount && fi.isSymLink()) {
+        // symLinkTarget is absolute, but can have symlinks in its directory part
+        const QFileInfo target(fi.symLinkTarget());
+        fi.setFile(canonicalDirectory(target.path()) + '/' + target.fileName());
+    }
+    if (count > maxCount)
+        return {};
+    return fi.filePath();
+}
+
+QString SymlinkResolver::canonicalDirectory(const QString &dirPath)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        const auto it = m_canonicalDirectories.constFind(dirPath);
+        if (it != m_canonicalDirectories.constEnd())
+            return *it;
+    }
+    // realpath, or the directory as is if it does not exist
+    QString canonicalPath = QDir(dirPath).canonicalPath();
+    if (canonicalPath.isEmpty())
+        canonicalPath = dirPath;
+    QMutexLocker locker(&m_mutex);
+    m_canonicalDirectories.insert(dirPath, canonicalPath);
+    return canonicalPath;
+}
+
 void revealInFinder(const QString &filePath)
 {
     // TODO non-macOS
@@ -1,10 +1,30 @@
 #pragma once
 
+#include <QHash>
+#include <QMutex>
 #include <QString>
 
 namespace Util {
 
 QString resolveSymlinks(const QString &filePath);
+
+// Resolves symlinks like resolveSymlinks, but remembers the canonical paths of the directories
+// that the links point into, so links into the same directory do not walk the same chain again.
+// The result has the canonical directory of the final target.
+// Can be used from several threads.
+class SymlinkResolver
+{
+public:
+    // isSymLink is usually known from the directory listing already
+    QString resolve(const QString &filePath, bool isSymLink);
+
+private:
+    QString canonicalDirectory(const QString &dirPath);
+
+    QMutex m_mutex;
+    QHash<QString, QString> m_canonicalDirectories;
+};
+
 void moveToTrash(const QStringList &filePaths);
 void revealInFinder(const QString &filePath);
 
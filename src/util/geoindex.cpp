@@ -0,0 +1,232 @@
+#include "geoindex.h"
+
+#include <QStringList>
+
+#include <algorithm>
+#include <cmath>
+
+const double kPi = 3.14159265358979323846;
+const double kEarthRadiusKm = 6371.0;
+// degrees, about 11 km in latitude
+const double kCellSize = 0.1;
+const int kRows = 1800;
+const int kColumns = 3600;
+
+static double toRadians(double degrees)
+{
+    return degrees * kPi / 180;
+}
+
+static double toDegrees(double radians)
+{
+    return radians * 180 / kPi;
+}
+
+// great circle distance
+static double distanceKm(const Util::GeoPosition &a, const Util::GeoPosition &b)
+{
+    const double dLatitude = toRadians(b.latitude - a.latitude);
+    const double dLongitude = toRadians(b.longitude - a.longitude);
+    const double h = std::pow(std::sin(dLatitude / 2), 2)
+                     + std::cos(toRadians(a.latitude)) * std::cos(toRadians(b.latitude))
+                           * std::pow(std::sin(dLongitude / 2), 2);
+    return 2 * kEarthRadiusKm * std::asin(std::min(1.0, std::sqrt(h)));
+}
+
+static int row(double latitude)
+{
+    return std::clamp(int(std::floor((latitude + 90) / kCellSize)), 0, kRows - 1);
+}
+
+static int column(double longitude)
+{
+    return std::clamp(int(std::floor((longitude + 180) / kCellSize)), 0, kColumns - 1);
+}
+
+static bool isLongitudeInRange(double longitude, double west, double east)
+{
+    if (west <= east)
+        return longitude >= west && longitude <= east;
+    return longitude >= west || longitude <= east;
+}
+
+static std::optional<std::vector<double>> parseNumbers(const QString &s, int count)
+{
+    const QStringList parts = s.split(',');
+    if (parts.size() != count)
+        return {};
+    std::vector<double> result;
+    for (const QString &part : parts) {
+        bool ok;
+        result.push_back(part.trimmed().toDouble(&ok));
+        if (!ok)
+            return {};
+    }
+    return result;
+}
+
+static bool isValid(double latitude, double longitude)
+{
+    return std::abs(latitude) <= 90 && std::abs(longitude) <= 180;
+}
+
+namespace Util {
+
+GeoArea GeoArea::box(double south, double west, double north, double east)
+{
+    GeoArea area;
+    area.shape = Shape::Box;
+    area.south = std::min(south, north);
+    area.north = std::max(south, north);
+    area.west = west;
+    area.east = east;
+    return area;
+}
+
+GeoArea GeoArea::circle(const GeoPosition &center, double radiusKm)
+{
+    GeoArea area;
+    area.shape = Shape::Circle;
+    area.center = center;
+    area.radiusKm = radiusKm;
+    const double angle = radiusKm / kEarthRadiusKm;
+    const double dLatitude = toDegrees(angle);
+    area.south = std::max(-90.0, center.latitude - dLatitude);
+    area.north = std::min(90.0, center.latitude + dLatitude);
+    // for the widest extent in longitude, which is not at the latitude of the center
+    const double ratio = std::sin(angle) / std::cos(toRadians(center.latitude));
+    if (area.north >= 90 || area.south <= -90 || ratio >= 1 || angle >= kPi / 2) {
+        area.west = -180;
+        area.east = 180;
+        return area;
+    }
+    const double dLongitude = toDegrees(std::asin(ratio));
+    area.west = center.longitude - dLongitude;
+    area.east = center.longitude + dLongitude;
+    if (area.west < -180)
+        area.west += 360;
+    if (area.east > 180)
+        area.east -= 360;
+    return area;
+}
+
+bool GeoArea::contains(const GeoPosition &position) const
+{
+    if (position.latitude < south || position.latitude > north
+        || !isLongitudeInRange(position.longitude, west, east)) {
+        return false;
+    }
+    return shape == Shape::Box || distanceKm(center, position) <= radiusKm;
+}
+
+bool GeoArea::operator==(const GeoArea &other) const
+{
+    return shape == other.shape && south == other.south && west == other.west
+           && north == other.north && east == other.east
+           && center.latitude == other.center.latitude
+           && center.longitude == other.center.longitude && radiusKm == other.radiusKm;
+}
+
+std::optional<GeoArea> parseGeoArea(const QString &term)
+{
+    if (term.startsWith("near:", Qt::CaseInsensitive)) {
+        const auto numbers = parseNumbers(term.mid(5), 3);
+        if (!numbers || !isValid(numbers->at(0), numbers->at(1)) || numbers->at(2) <= 0)
+            return {};
+        return GeoArea::circle({numbers->at(0), numbers->at(1)}, numbers->at(2));
+    }
+    if (term.startsWith("box:", Qt::CaseInsensitive)) {
+        const auto numbers = parseNumbers(term.mid(4), 4);
+        if (!numbers || !isValid(numbers->at(0), numbers->at(1))
+            || !isValid(numbers->at(2), numbers->at(3))) {
+            return {};
+        }
+        return GeoArea::box(numbers->at(0), numbers->at(1), numbers->at(2), numbers->at(3));
+    }
+    return {};
+}
+
+void GeoIndex::insert(Id id, const GeoPosition &position)
+{
+    if (id >= m_positions.size())
+        m_positions.resize(id + 1);
+    m_positions.at(id) = position;
+    m_cells[CellKey(row(position.latitude) * kColumns + column(position.longitude))].push_back(id);
+}
+
+void GeoIndex::remove(Id id)
+{
+    if (id >= m_positions.size() || !m_positions.at(id))
+        return;
+    const GeoPosition &position = *m_positions.at(id);
+    const CellKey key = CellKey(row(position.latitude) * kColumns + column(position.longitude));
+    const auto cell = m_cells.find(key);
+    if (cell != m_cells.end()) {
+        cell->erase(std::remove(cell->begin(), cell->end(), id), cell->end());
+        if (cell->empty())
+            m_cells.erase(cell);
+    }
+    m_positions.at(id).reset();
+}
+
+void GeoIndex::clear()
+{
+    m_positions.clear();
+    m_cells.clear();
+}
+
+void GeoIndex::match(const GeoArea &area, std::vector<bool> &result) const
+{
+    const int firstRow = row(area.south);
+    const int lastRow = row(area.north);
+    // boxes that cross the antimeridian have two ranges of columns
+    std::vector<std::pair<int, int>> columnRanges;
+    if (area.west <= area.east) {
+        columnRanges.push_back({column(area.west), column(area.east)});
+    } else {
+        columnRanges.push_back({column(area.west), kColumns - 1});
+        columnRanges.push_back({0, column(area.east)});
+    }
+    const auto isColumnInRange = [&columnRanges](int c) {
+        return std::any_of(columnRanges.cbegin(), columnRanges.cend(), [c](const auto &range) {
+            return c >= range.first && c <= range.second;
+        });
+    };
+    const auto matchCell = [&](int r, int c, const std::vector<Id> &ids) {
+        // items in cells completely inside of a box do not need to be checked
+        const double cellSouth = r * kCellSize - 90;
+        const double cellWest = c * kCellSize - 180;
+        const bool isInside = area.shape == GeoArea::Shape::Box && area.west <= area.east
+                              && cellSouth >= area.south && cellSouth + kCellSize <= area.north
+                              && cellWest >= area.west && cellWest + kCellSize <= area.east;
+        for (const Id id : ids) {
+            if (id < result.size() && (isInside || area.contains(*m_positions.at(id))))
+                result[id] = true;
+        }
+    };
+
+    qint64 cellCount = 0;
+    for (const auto &range : columnRanges)
+        cellCount += qint64(lastRow - firstRow + 1) * (range.second - range.first + 1);
+    if (cellCount > m_cells.size()) {
+        // large areas, fewer occupied cells than cells in the area
+        for (auto it = m_cells.cbegin(); it != m_cells.cend(); ++it) {
+            const int r = int(it.key() / kColumns);
+            const int c = int(it.key() % kColumns);
+            if (r >= firstRow && r <= lastRow && isColumnInRange(c))
+                matchCell(r, c, it.value());
+        }
+        return;
+    }
+    for (int r = firstRow; r <= lastRow; ++r) {
+        for (const auto &range : columnRanges) {
+            for (int c = range.first; c <= range.second; ++c) {
+                const auto it = m_cells.constFind(CellKey(r * kColumns + c));
+                if (it != m_cells.cend())
+                    matchCell(r, c, it.value());
+            }
+        }
+    }
+}
+
+} // namespace Util
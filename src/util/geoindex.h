@@ -0,0 +1,62 @@
+#pragma once
+
+#include "metadatautil.h"
+
+#include <QHash>
+#include <QString>
+
+#include <optional>
+#include <vector>
+
+namespace Util {
+
+// A bounding box, or a circle around a center.
+class GeoArea
+{
+public:
+    enum class Shape { Box, Circle };
+
+    static GeoArea box(double south, double west, double north, double east);
+    static GeoArea circle(const GeoPosition &center, double radiusKm);
+
+    bool contains(const GeoPosition &position) const;
+    bool operator==(const GeoArea &other) const;
+
+    Shape shape = Shape::Box;
+    // the box, or the box around the circle
+    // west > east for boxes that cross the antimeridian
+    double south = 0;
+    double west = 0;
+    double north = 0;
+    double east = 0;
+    GeoPosition center;
+    double radiusKm = 0;
+};
+
+// Parses "near:latitude,longitude,km" and "box:south,west,north,east".
+// Returns std::nullopt for other terms.
+std::optional<GeoArea> parseGeoArea(const QString &term);
+
+// Positions of items in a grid of cells of a fixed size. Area queries only look at the cells that
+// overlap the bounding box of the area, and only check the positions of the items in cells that
+// are not completely inside of it. Not thread-safe.
+class GeoIndex
+{
+public:
+    using Id = quint32;
+
+    void insert(Id id, const GeoPosition &position);
+    void remove(Id id);
+    void clear();
+
+    // sets the entries of the items in the area to true, ids must be smaller than result.size()
+    void match(const GeoArea &area, std::vector<bool> &result) const;
+
+private:
+    using CellKey = quint32;
+
+    std::vector<std::optional<GeoPosition>> m_positions;
+    QHash<CellKey, std::vector<Id>> m_cells;
+};
+
+} // namespace Util
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+
+namespace Util {
+
+// Costs of keys in least recently used order, for keeping caches that live elsewhere within a
+// budget. Only does the bookkeeping, evicting is left to the caller. Not thread-safe.
+template<typename Key>
+class LruCosts
+{
+public:
+    using const_iterator = typename std::list<Key>::const_iterator;
+
+    // inserts the key or updates its cost, and makes it the most recently used one
+    void set(const Key &key, std::int64_t cost)
+    {
+        const auto it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            m_total += cost - it->second.cost;
+            it->second.cost = cost;
+            m_order.splice(m_order.end(), m_order, it->second.position);
+            return;
+        }
+        m_order.push_back(key);
+        m_entries.emplace(key, Entry{std::prev(m_order.end()), cost});
+        m_total += cost;
+    }
+
+    // changes the cost of a known key without making it more recently used
+    void update(const Key &key, std::int64_t cost)
+    {
+        const auto it = m_entries.find(key);
+        if (it == m_entries.end())
+            return;
+        m_total += cost - it->second.cost;
+        it->second.cost = cost;
+    }
+
+    // makes the key the most recently used one, if it is known
+    void touch(const Key &key)
+    {
+        const auto it = m_entries.find(key);
+        if (it != m_entries.end())
+            m_order.splice(m_order.end(), m_order, it->second.position);
+    }
+
+    void remove(const Key &key)
+    {
+        const auto it = m_entries.find(key);
+        if (it == m_entries.end())
+            return;
+        m_total -= it->second.cost;
+        m_order.erase(it->second.position);
+        m_entries.erase(it);
+    }
+
+    void clear()
+    {
+        m_order.clear();
+        m_entries.clear();
+        m_total = 0;
+    }
+
+    bool contains(const Key &key) const { return m_entries.find(key) != m_entries.end(); }
+    std::int64_t cost(const Key &key) const
+    {
+        const auto it = m_entries.find(key);
+        return it != m_entries.end() ? it->second.cost : 0;
+    }
+    std::int64_t totalCost() const { return m_total; }
+    std::size_t size() const { return m_entries.size(); }
+
+    // least recently used first
+    const_iterator begin() const { return m_order.cbegin(); }
+    const_iterator end() const { return m_order.cend(); }
+
+private:
+    struct Entry
+    {
+        typename std::list<Key>::iterator position;
+        std::int64_t cost;
+    };
+
+    std::list<Key> m_order;
+    std::unordered_map<Key, Entry> m_entries;
+    std::int64_t m_total = 0;
+};
+
+} // namespace Util
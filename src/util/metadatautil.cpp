@@ -1,11 +1,24 @@
 #include "metadatautil.h"
 
+#include "bmffparser.h"
+#include "exifparser.h"
+#include "fileprobe.h"
 #include "tags.h"
+#include "tagstore.h"
+#include "windowedfileio.h"
 
-#include <QPainter>
+#include <QBuffer>
+#include <QFile>
+#include <QImageReader>
+#include <QMimeDatabase>
 
 #include <exiv2/exiv2.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
 static std::optional<int> getIntFromStringXmp(const Exiv2::XmpData &data, const std::string &key)
 {
     const Exiv2::XmpKey xkey(key);
@@ -33,52 +46,69 @@ static std::optional<QDateTime> extractExifCreationDateTime(const Exiv2::ExifDat
     return {};
 }
 
-static std::optional<QPixmap> extractExifThumbnail(const Exiv2::ExifData &exifData,
-                                                   const QSize &imageDimensions,
-                                                   Util::Orientation orientation)
+// position of the TIFF header in the Exif APP1 segment of a JPEG
+static std::optional<qint64> jpegTiffHeaderOffset(Exiv2::BasicIo &io)
+{
+    if (io.open() != 0)
+        return {};
+    Exiv2::IoCloser closer(io);
+    Exiv2::byte buf[10];
+    if (io.read(buf, 2) != 2 || buf[0] != 0xff || buf[1] != 0xd8)
+        return {};
+    for (;;) {
+        if (io.read(buf, 4) != 4 || buf[0] != 0xff)
+            return {};
+        const Exiv2::byte marker = buf[1];
+        // start of scan or end of image, no meta data after that
+        if (marker == 0xda || marker == 0xd9)
+            return {};
+        const int length = (buf[2] << 8) | buf[3];
+        if (length < 2)
+            return {};
+        if (marker == 0xe1 && length >= 8) {
+            const qint64 dataStart = qint64(io.tell());
+            if (io.read(buf, 6) == 6 && std::memcmp(buf, "Exif\0\0", 6) == 0)
+                return dataStart + 6;
+            if (io.seek(dataStart, Exiv2::BasicIo::beg) != 0)
+                return {};
+        }
+        if (io.seek(length - 2, Exiv2::BasicIo::cur) != 0)
+            return {};
+    }
+}
+
+// only remembers where the thumbnail is, decoding it is left to embeddedThumbnail
+static std::optional<Util::EmbeddedThumbnail> extractExifThumbnail(Exiv2::Image &image)
 {
+    const Exiv2::ExifData &exifData = image.exifData();
     if (exifData.empty())
         return {};
     Exiv2::ExifThumbC thumb(exifData);
-    std::string ext = thumb.extension();
-    if (ext.empty())
+    if (thumb.extension().empty())
         return {};
-    const Exiv2::DataBuf &data = thumb.copy();
-    QPixmap pixmap;
-    // cut thumbnail to original's aspect ratio, some cameras do weird things
-    if (pixmap.loadFromData(data.c_data(), data.size())) {
-        const auto rotatedPixmap = pixmap.transformed(
-            Util::matrixForOrientation(pixmap.size(), orientation).toTransform());
-        if (rotatedPixmap.size().width() == 0 || rotatedPixmap.height() == 0
-            || imageDimensions.width() == 0 || imageDimensions.height() == 0) {
-            return {rotatedPixmap};
+    Util::EmbeddedThumbnail result;
+    const auto offsetMd = exifData.findKey(Exiv2::ExifKey("Exif.Thumbnail.JPEGInterchangeFormat"));
+    const auto sizeMd = exifData.findKey(
+        Exiv2::ExifKey("Exif.Thumbnail.JPEGInterchangeFormatLength"));
+    if (offsetMd != exifData.end() && sizeMd != exifData.end()) {
+        std::optional<qint64> tiffHeaderOffset;
+        if (image.mimeType() == "image/tiff")
+            tiffHeaderOffset = 0;
+        else if (image.mimeType() == "image/jpeg")
+            tiffHeaderOffset = jpegTiffHeaderOffset(image.io());
+        const qint64 size = sizeMd->toInt64();
+        const qint64 offset = tiffHeaderOffset ? *tiffHeaderOffset + offsetMd->toInt64() : -1;
+        if (offset >= 0 && size > 0 && offset + size <= qint64(image.io().size())) {
+            result.offset = offset;
+            result.size = size;
+            return result;
         }
-        // potentially cut left/right
-        const int widthFromHeight = rotatedPixmap.height() * imageDimensions.width()
-                                    / imageDimensions.height();
-        const int xoffset = widthFromHeight < rotatedPixmap.width()
-                                ? (rotatedPixmap.width() - widthFromHeight) / 2
-                                : 0;
-        const int targetWidth = widthFromHeight < rotatedPixmap.width() ? widthFromHeight
-                                                                        : rotatedPixmap.width();
-        // potentially cut top/bottom
-        const int heightFromWidth = rotatedPixmap.width() * imageDimensions.height()
-                                    / imageDimensions.width();
-        const int yoffset = heightFromWidth < rotatedPixmap.height()
-                                ? (rotatedPixmap.height() - heightFromWidth) / 2
-                                : 0;
-        const int targetHeight = heightFromWidth < rotatedPixmap.height() ? heightFromWidth
-                                                                          : rotatedPixmap.height();
-        if (xoffset == 0 && yoffset == 0)
-            return {rotatedPixmap};
-        QPixmap cutPixmap(targetWidth, targetHeight);
-        QPainter painter(&cutPixmap);
-        painter.drawPixmap(QPoint(0, 0),
-                           rotatedPixmap,
-                           QRect(xoffset, yoffset, targetWidth, targetHeight));
-        return {cutPixmap};
     }
-    return {};
+    // location unknown, keep the (small) encoded data
+    const Exiv2::DataBuf data = thumb.copy();
+    result.data = QByteArray(reinterpret_cast<const char *>(data.c_data()), qsizetype(data.size()));
+    result.size = result.data.size();
+    return result;
 }
 
 static Util::Orientation extractExifOrientation(const Exiv2::ExifData &exifData)
@@ -106,6 +136,77 @@ static std::optional<QSize> extractExifPixelDimensions(const Exiv2::ExifData &ex
     return {};
 }
 
+static QString cameraName(const QString &make, const QString &model)
+{
+    return model.isEmpty() ? make : model;
+}
+
+static QString extractExifString(const Exiv2::ExifData &exifData, const char *key)
+{
+    const auto md = exifData.findKey(Exiv2::ExifKey(key));
+    if (md != exifData.end() && md->typeId() == Exiv2::asciiString)
+        return QString::fromStdString(md->toString()).trimmed();
+    return {};
+}
+
+static void extractExifCameraSettings(const Exiv2::ExifData &exifData, Util::MetaData &data)
+{
+    if (exifData.empty())
+        return;
+    data.camera = cameraName(extractExifString(exifData, "Exif.Image.Make"),
+                             extractExifString(exifData, "Exif.Image.Model"));
+    data.lens = extractExifString(exifData, "Exif.Photo.LensModel");
+    const auto isoMd = exifData.findKey(Exiv2::ExifKey("Exif.Photo.ISOSpeedRatings"));
+    if (isoMd != exifData.end() && isoMd->typeId() == Exiv2::unsignedShort && isoMd->count() > 0)
+        data.iso = int(isoMd->toInt64(0));
+    const auto focalMd = exifData.findKey(Exiv2::ExifKey("Exif.Photo.FocalLength"));
+    if (focalMd != exifData.end() && focalMd->typeId() == Exiv2::unsignedRational
+        && focalMd->count() > 0) {
+        const Exiv2::Rational value = focalMd->toRational(0);
+        if (value.second != 0)
+            data.focalLength = double(quint32(value.first)) / quint32(value.second);
+    }
+}
+
+// degrees, minutes and seconds, negative for the given reference
+static std::optional<double> extractExifCoordinate(const Exiv2::ExifData &exifData,
+                                                   const char *key,
+                                                   const char *refKey,
+                                                   char negativeRef)
+{
+    const auto md = exifData.findKey(Exiv2::ExifKey(key));
+    const auto refMd = exifData.findKey(Exiv2::ExifKey(refKey));
+    if (md == exifData.end() || md->typeId() != Exiv2::unsignedRational || md->count() != 3
+        || refMd == exifData.end() || refMd->typeId() != Exiv2::asciiString) {
+        return {};
+    }
+    double value = 0;
+    for (size_t i = 0; i < 3; ++i) {
+        const Exiv2::Rational part = md->toRational(i);
+        if (part.second == 0)
+            return {};
+        value += double(quint32(part.first)) / quint32(part.second) / std::pow(60, i);
+    }
+    return refMd->toString().rfind(negativeRef, 0) == 0 ? -value : value;
+}
+
+static std::optional<Util::GeoPosition> extractExifPosition(const Exiv2::ExifData &exifData)
+{
+    if (exifData.empty())
+        return {};
+    const std::optional<double> latitude = extractExifCoordinate(exifData,
+                                                                 "Exif.GPSInfo.GPSLatitude",
+                                                                 "Exif.GPSInfo.GPSLatitudeRef",
+                                                                 'S');
+    const std::optional<double> longitude = extractExifCoordinate(exifData,
+                                                                  "Exif.GPSInfo.GPSLongitude",
+                                                                  "Exif.GPSInfo.GPSLongitudeRef",
+                                                                  'W');
+    if (!latitude || !longitude || qAbs(*latitude) > 90 || qAbs(*longitude) > 180)
+        return {};
+    return Util::GeoPosition{*latitude, *longitude};
+}
+
 static std::optional<QDateTime> extractXmpDateTime(const Exiv2::XmpData &data)
 {
     if (data.empty())
@@ -160,6 +261,131 @@ static QSize dimensions(const QSize &imageSize, Util::Orientation orientation)
     return imageSize;
 }
 
+// reading meta data usually takes tens of kilobytes, more than this fails instead of reading
+// through large files on slow file systems
+const qint64 kMaxMetaDataBytesRead = 1024 * 1024;
+
+// Only reads the parts of the file that the parser needs, starting with the given header.
+// For JPEG the meta data segments usually are all in the header, for video containers and TIFF
+// layouts the parser skips over the media data instead of reading it.
+static Exiv2::Image::UniquePtr openImage(const QString &filePath,
+                                         const QByteArray &header = {},
+                                         std::optional<qint64> size = {},
+                                         std::optional<qint64> maxBytesRead = {})
+{
+    auto image = Exiv2::ImageFactory::open(
+        std::make_unique<Util::WindowedFileIo>(filePath, header, size, maxBytesRead));
+    if (!image)
+        throw Exiv2::Error(Exiv2::ErrorCode::kerFileContainsUnknownImageType,
+                           filePath.toStdString());
+    image->readMetadata();
+    return image;
+}
+
+static Util::MetaData metaDataFromImage(Exiv2::Image &image)
+{
+    Util::MetaData data;
+    // check exif data
+    const Exiv2::ExifData &exifData = image.exifData();
+    data.created = extractExifCreationDateTime(exifData);
+    data.orientation = extractExifOrientation(exifData);
+    data.dimensions = extractExifPixelDimensions(exifData);
+    extractExifCameraSettings(exifData, data);
+    data.position = extractExifPosition(exifData);
+
+    // check xmp data
+    const Exiv2::XmpData &xmpData = image.xmpData();
+    if (!data.created)
+        data.created = extractXmpDateTime(xmpData);
+    if (!data.dimensions)
+        data.dimensions = extractXmpDimensions(xmpData);
+    data.duration = extractXmpDuration(xmpData);
+
+    if (!data.dimensions && image.pixelWidth() != 0 && image.pixelHeight() != 0)
+        data.dimensions = QSize(image.pixelWidth(), image.pixelHeight());
+    if (data.dimensions)
+        data.dimensions = dimensions(*data.dimensions, data.orientation);
+    data.thumbnail = extractExifThumbnail(image);
+    return data;
+}
+
+// cut thumbnail to original's aspect ratio, some cameras do weird things
+static QImage cutToAspectRatio(const QImage &image, const QSize &imageDimensions)
+{
+    if (image.isNull() || imageDimensions.isEmpty())
+        return image;
+    const int widthFromHeight = image.height() * imageDimensions.width()
+                                / imageDimensions.height();
+    const int heightFromWidth = image.width() * imageDimensions.height()
+                                / imageDimensions.width();
+    const int targetWidth = std::min(widthFromHeight, image.width());
+    const int targetHeight = std::min(heightFromWidth, image.height());
+    if (targetWidth == image.width() && targetHeight == image.height())
+        return image;
+    return image.copy((image.width() - targetWidth) / 2,
+                      (image.height() - targetHeight) / 2,
+                      targetWidth,
+                      targetHeight);
+}
+
+// decodes directly to a size that fits into maxSize x maxSize
+static QImage decodePreview(const Exiv2::PreviewImage &preview, int maxSize)
+{
+    QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char *>(preview.pData()),
+                                              qsizetype(preview.size()));
+    QBuffer buffer(&data);
+    QImageReader reader(&buffer);
+    reader.setAutoTransform(false);
+    const QSize size = reader.size();
+    if (size.isValid() && (size.width() > maxSize || size.height() > maxSize))
+        reader.setScaledSize(size.scaled(maxSize, maxSize, Qt::KeepAspectRatio));
+    return reader.read();
+}
+
+static QList<QString> tagsForProbe(const QString &filePath, const Util::FileProbe &probe)
+{
+    return Util::TagStore::instance().tags(filePath,
+                                           probe.stat ? &*probe.stat : nullptr,
+                                           probe.attribute);
+}
+
+// the smallest preview that is at least minSize on its longer side, or the largest one if there
+// is no minSize, or orLargest is set and no preview is large enough
+static QImage previewImage(const QString &filePath, std::optional<int> minSize, bool orLargest)
+{
+    try {
+        auto image = openImage(filePath);
+        Exiv2::PreviewManager manager(*image);
+        // sorted by size, smallest first
+        const Exiv2::PreviewPropertiesList previews = manager.getPreviewProperties();
+        auto preview = minSize ? std::find_if(previews.cbegin(),
+                                              previews.cend(),
+                                              [minSize](const Exiv2::PreviewProperties &p) {
+                                                  return int(std::max(p.width_, p.height_))
+                                                         >= *minSize;
+                                              })
+                               : previews.cend();
+        if (preview == previews.cend() && (!minSize || orLargest) && !previews.empty())
+            preview = previews.cend() - 1;
+        if (preview == previews.cend())
+            return {};
+        const QImage decoded = decodePreview(manager.getPreviewImage(*preview),
+                                             minSize ? *minSize
+                                                     : std::numeric_limits<int>::max());
+        if (decoded.isNull())
+            return {};
+        const Exiv2::ExifData &exifData = image->exifData();
+        std::optional<QSize> imageSize = extractExifPixelDimensions(exifData);
+        if (!imageSize && image->pixelWidth() != 0 && image->pixelHeight() != 0)
+            imageSize = QSize(image->pixelWidth(), image->pixelHeight());
+        const QImage cut = cutToAspectRatio(decoded, imageSize ? *imageSize : QSize());
+        return cut.transformed(
+            Util::matrixForOrientation(cut.size(), extractExifOrientation(exifData)).toTransform());
+    } catch (...) {
+    }
+    return {};
+}
+
 namespace Util {
 
 QMatrix4x4 matrixForOrientation(const QSize &size, Util::Orientation orientation)
@@ -188,35 +414,87 @@ QMatrix4x4 matrixForOrientation(const QSize &size, Util::Orientation orientation
     return {};
 }
 
+QImage embeddedThumbnail(const QString &filePath, const MetaData &metaData)
+{
+    if (!metaData.thumbnail)
+        return {};
+    QByteArray data = metaData.thumbnail->data;
+    if (metaData.thumbnail->offset >= 0) {
+        QFile file(filePath);
+        if (!file.open(QIODevice::ReadOnly) || !file.seek(metaData.thumbnail->offset))
+            return {};
+        data = file.read(metaData.thumbnail->size);
+    }
+    QImage image;
+    if (!image.loadFromData(data))
+        return {};
+    const QImage rotated = image.transformed(
+        matrixForOrientation(image.size(), metaData.orientation).toTransform());
+    return cutToAspectRatio(rotated, metaData.dimensions ? *metaData.dimensions : QSize());
+}
+
+bool isRawImage(const QMimeType &mimeType)
+{
+    // most RAW formats inherit image/x-dcraw in shared-mime-info, and some also image/tiff
+    static const QStringList rawMimeTypes = {"image/x-dcraw",
+                                             "image/x-adobe-dng",
+                                             "image/x-canon-cr2",
+                                             "image/x-canon-cr3",
+                                             "image/x-canon-crw",
+                                             "image/x-fuji-raf",
+                                             "image/x-nikon-nef",
+                                             "image/x-nikon-nrw",
+                                             "image/x-olympus-orf",
+                                             "image/x-panasonic-rw2",
+                                             "image/x-pentax-pef",
+                                             "image/x-samsung-srw",
+                                             "image/x-sony-arw",
+                                             "image/x-sony-sr2",
+                                             "image/x-sony-srf"};
+    return std::any_of(rawMimeTypes.cbegin(),
+                       rawMimeTypes.cend(),
+                       [&mimeType](const QString &name) {
+                           return mimeType.name() == name || mimeType.inherits(name);
+                       });
+}
+
+bool isRawImage(const QString &filePath)
+{
+    static const QMimeDatabase mdb;
+    return isRawImage(mdb.mimeTypeForFile(filePath, QMimeDatabase::MatchExtension));
+}
+
+bool hasEmbeddedPreviews(const QString &filePath)
+{
+    static const QMimeDatabase mdb;
+    static const QStringList previewMimeTypes = {"image/jpeg",
+                                                 "image/tiff",
+                                                 "image/heif",
+                                                 "image/heic",
+                                                 "image/avif"};
+    const QMimeType mimeType = mdb.mimeTypeForFile(filePath, QMimeDatabase::MatchExtension);
+    return isRawImage(mimeType)
+           || std::any_of(previewMimeTypes.cbegin(),
+                          previewMimeTypes.cend(),
+                          [&mimeType](const QString &name) { return mimeType.inherits(name); });
+}
+
+QImage embeddedPreview(const QString &filePath, int minSize, bool orLargest)
+{
+    return previewImage(filePath, minSize, orLargest);
+}
+
+QImage largestEmbeddedPreview(const QString &filePath)
+{
+    return previewImage(filePath, {}, true);
+}
+
 MetaData metaData(const QString &filePath)
 {
     MetaData data;
     try {
-        auto image = Exiv2::ImageFactory::open(filePath.toStdString());
-        image->readMetadata();
-
-        // check exif data
-        const Exiv2::ExifData &exifData = image->exifData();
-        data.created = extractExifCreationDateTime(exifData);
-        data.orientation = extractExifOrientation(exifData);
-        data.dimensions = extractExifPixelDimensions(exifData);
-
-        // check xmp data
-        const Exiv2::XmpData &xmpData = image->xmpData();
-        if (!data.created)
-            data.created = extractXmpDateTime(xmpData);
-        if (!data.dimensions)
-            data.dimensions = extractXmpDimensions(xmpData);
-        data.duration = extractXmpDuration(xmpData);
-
-        if (!data.dimensions && image->pixelWidth() != 0 && image->pixelHeight() != 0)
-            data.dimensions = QSize(image->pixelWidth(), image->pixelHeight());
-        if (data.dimensions)
-            data.dimensions = dimensions(*data.dimensions, data.orientation);
-        data.thumbnail = extractExifThumbnail(exifData,
-                                              data.dimensions ? *data.dimensions : QSize(),
-                                              data.orientation);
-
+        auto image = openImage(filePath, {}, {}, kMaxMetaDataBytesRead);
+        data = metaDataFromImage(*image);
         data.tags = getTags(filePath);
         return data;
     } catch (...) {
@@ -224,4 +502,43 @@ MetaData metaData(const QString &filePath)
     return data;
 }
 
+MetaData metaData(const QString &filePath, const FileProbe &probe, MetaDataParser parser)
+{
+    const std::optional<qint64> size = probe.stat ? std::make_optional(probe.stat->size)
+                                                  : std::nullopt;
+    MetaData data;
+    // the native TIFF parser would only see the first IFD of TIFF based RAW formats
+    if (parser == MetaDataParser::Auto && !isRawImage(filePath)) {
+        if (const std::optional<ExifFields> fields = parseExif(probe.header, size)) {
+            data.created = fields->created;
+            data.orientation = fields->orientation;
+            if (fields->pixelDimensions)
+                data.dimensions = dimensions(*fields->pixelDimensions, fields->orientation);
+            data.thumbnail = fields->thumbnail;
+            data.camera = cameraName(fields->make, fields->model);
+            data.lens = fields->lens;
+            data.iso = fields->iso;
+            data.focalLength = fields->focalLength;
+            data.position = fields->position;
+            data.tags = tagsForProbe(filePath, probe);
+            return data;
+        }
+        if (const std::optional<MovieFields> fields = parseMovie(filePath, probe.header, size)) {
+            data.created = fields->created;
+            data.duration = fields->duration;
+            data.dimensions = fields->dimensions;
+            data.tags = tagsForProbe(filePath, probe);
+            return data;
+        }
+    }
+    try {
+        auto image = openImage(filePath, probe.header, size, kMaxMetaDataBytesRead);
+        data = metaDataFromImage(*image);
+        data.tags = tagsForProbe(filePath, probe);
+        return data;
+    } catch (...) {
+    }
+    return data;
+}
+
 } // namespace Util
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <QByteArray>
 #include <QDateTime>
+#include <QImage>
 #include <QMatrix4x4>
-#include <QPixmap>
+#include <QMimeType>
 #include <QSize>
 #include <QString>
 
@@ -11,6 +13,8 @@
 
 namespace Util {
 
+class FileProbe;
+
 enum class Orientation {
     Normal = 1,
     FlippedHorizontal = 2,
@@ -22,18 +26,65 @@ enum class Orientation {
     RotatedClockwise = 8
 };
 
+// location of the thumbnail that is embedded in the meta data
+class EmbeddedThumbnail
+{
+public:
+    // position in the file, or -1 if only the data is known
+    qint64 offset = -1;
+    qint64 size = 0;
+    QByteArray data;
+};
+
+class GeoPosition
+{
+public:
+    double latitude = 0; // degrees, positive north
+    double longitude = 0; // degrees, positive east
+};
+
 class MetaData
 {
 public:
     std::optional<QSize> dimensions;
     std::optional<QDateTime> created;
-    std::optional<QPixmap> thumbnail;
+    std::optional<EmbeddedThumbnail> thumbnail;
     std::optional<qint64> duration;
-    Orientation orientation;
+    Orientation orientation = Orientation::Normal;
     QList<QString> tags;
+    // camera model, or the make if the model is unknown
+    QString camera;
+    QString lens;
+    std::optional<int> iso;
+    std::optional<double> focalLength; // mm
+    std::optional<GeoPosition> position;
+};
+
+enum class MetaDataParser {
+    Auto, // native parsers for plain JPEG, TIFF and MP4/QuickTime files, exiv2 for the rest
+    Exiv2
 };
 
 QMatrix4x4 matrixForOrientation(const QSize &size, Util::Orientation orientation);
 MetaData metaData(const QString &filePath);
+// uses the header and attribute read by probeFiles where possible
+MetaData metaData(const QString &filePath,
+                  const FileProbe &probe,
+                  MetaDataParser parser = MetaDataParser::Auto);
+// Decodes the embedded thumbnail, rotated and cut to the aspect ratio of the image.
+// Can be used from any thread. Returns a null image if there is none or it cannot be read.
+QImage embeddedThumbnail(const QString &filePath, const MetaData &metaData);
+// Decodes the smallest embedded preview image that is at least minSize on its longer side,
+// restricted to minSize, rotated, and cut to the aspect ratio of the image.
+// Can be used from any thread. Returns a null image if no preview is large enough, or the
+// largest preview if orLargest is set.
+QImage embeddedPreview(const QString &filePath, int minSize, bool orLargest = false);
+// Decodes the largest embedded preview image, rotated and cut to the aspect ratio of the image.
+QImage largestEmbeddedPreview(const QString &filePath);
+// Camera RAW formats, which are only shown through their embedded previews.
+bool isRawImage(const QMimeType &mimeType);
+bool isRawImage(const QString &filePath);
+// Formats that can embed previews, RAW, JPEG, TIFF and HEIF, by file name.
+bool hasEmbeddedPreviews(const QString &filePath);
 
 } // namespace Util
@@ -1,30 +1,126 @@
 #include "tags.h"
 
+#include "tagstore.h"
+
 #include <Plist.hpp>
 
 #include <QDebug>
+#include <QFile>
+#include <QMutex>
+#include <QSet>
 
 #ifdef Q_OS_UNIX
 #include <sys/xattr.h>
+
+#include <cerrno>
+
+#ifndef ENOATTR
+#define ENOATTR ENODATA
+#endif
 #endif
 
-const char kItemUserTags[] = "com.apple.metadata:_kMDItemUserTags";
+#ifdef Q_OS_MACOS
+const char kTagsAttribute[] = "com.apple.metadata:_kMDItemUserTags";
+#else
+// https://www.freedesktop.org/wiki/CommonExtendedAttributes/, a comma separated list
+const char kTagsAttribute[] = "user.xdg.tags";
+
+// commas and backslashes in tags are escaped with a backslash
+static QByteArray joinTags(const QList<QString> &tags)
+{
+    QStringList escaped;
+    for (QString tag : tags)
+        escaped.append(tag.replace('\\', "\\\\").replace(',', "\\,"));
+    return escaped.join(',').toUtf8();
+}
 
-static std::optional<QByteArray> qgetxattr(const QString &filepath, const QString &attr)
+static QList<QString> splitTags(const QString &value)
 {
+    QList<QString> tags;
+    QString tag;
+    const auto add = [&tags, &tag] {
+        tag = tag.trimmed();
+        if (!tag.isEmpty())
+            tags.append(tag);
+        tag.clear();
+    };
+    for (qsizetype i = 0; i < value.size(); ++i) {
+        if (value.at(i) == '\\' && i + 1 < value.size())
+            tag.append(value.at(++i));
+        else if (value.at(i) == ',')
+            add();
+        else
+            tag.append(value.at(i));
+    }
+    add();
+    return tags;
+}
+#endif
+
 #ifdef Q_OS_UNIX
-    const auto bFilepath = filepath.toUtf8();
-    const auto path = bFilepath.data();
-    const auto bAttr = attr.toUtf8();
-    const auto name = bAttr.data();
-    const auto size = getxattr(path, name, NULL, 0, 0, 0);
-    if (size < 0)
+static ssize_t sysgetxattr(const char *path, const char *name, void *value, size_t size)
+{
+#ifdef Q_OS_MACOS
+    return getxattr(path, name, value, size, 0, 0);
+#else
+    return getxattr(path, name, value, size);
+#endif
+}
+
+static int syssetxattr(const char *path, const char *name, const void *value, size_t size)
+{
+#ifdef Q_OS_MACOS
+    return setxattr(path, name, value, size, 0, 0);
+#else
+    return setxattr(path, name, value, size, 0);
+#endif
+}
+
+static int sysremovexattr(const char *path, const char *name)
+{
+#ifdef Q_OS_MACOS
+    return removexattr(path, name, 0);
+#else
+    return removexattr(path, name);
+#endif
+}
+
+static bool isUnsupportedError(int error)
+{
+    return error == ENOTSUP || error == EOPNOTSUPP;
+}
+#endif
+
+static std::optional<QByteArray> qgetxattr(const QString &filepath, const char *name)
+{
+#ifdef Q_OS_UNIX
+    const QByteArray path = QFile::encodeName(filepath);
+    // tag lists are short, so usually a single call is enough
+    char buffer[1024];
+    const auto size = sysgetxattr(path.constData(), name, buffer, sizeof(buffer));
+    if (size >= 0)
+        return QByteArray(buffer, size);
+    if (errno != ERANGE)
         return {};
+    // the value can change in between, so retry until it fits
     QByteArray ret;
-    ret.resize(size);
-    getxattr(path, name, ret.data(), size, 0, 0);
-    return ret;
+    for (int i = 0; i < 3; ++i) {
+        const auto requiredSize = sysgetxattr(path.constData(), name, nullptr, 0);
+        if (requiredSize < 0)
+            return {};
+        ret.resize(requiredSize);
+        const auto readSize = sysgetxattr(path.constData(), name, ret.data(), ret.size());
+        if (readSize >= 0) {
+            ret.resize(readSize);
+            return ret;
+        }
+        if (errno != ERANGE)
+            return {};
+    }
+    return {};
 #else
+    Q_UNUSED(filepath)
+    Q_UNUSED(name)
     return {};
 #endif
 }
@@ -38,21 +134,203 @@ static int qsetxattr(const QString &filepath, const QString &attr, const QByteAr
     const auto name = bAttr.data();
     const auto value = data.data();
     const auto valueSize = data.size();
-    return setxattr(path, name, data, valueSize, 0, 0);
+    return syssetxattr(path, name, value, valueSize);
+#else
+    return 45 /* ENOTSUP Operation not supported */;
+#endif
+}
+
+static int qremovexattr(const QString &filepath, const char *name)
+{
+#ifdef Q_OS_UNIX
+    const int result = sysremovexattr(QFile::encodeName(filepath).constData(), name);
+    // nothing to remove is fine
+    return result != 0 && errno == ENOATTR ? 0 : result;
 #else
+    Q_UNUSED(filepath)
+    Q_UNUSED(name)
     return 45 /* ENOTSUP Operation not supported */;
 #endif
 }
 
+static quint64 readBigEndian(const uchar *data, int size)
+{
+    quint64 value = 0;
+    for (int i = 0; i < size; ++i)
+        value = (value << 8) | data[i];
+    return value;
+}
+
+// Decodes the one shape that is stored for tags, a binary property list with an array of strings.
+// Returns std::nullopt for anything else.
+static std::optional<QList<QString>> decodeStringArray(const QByteArray &value)
+{
+    static const qsizetype trailerSize = 32;
+    if (value.size() < 8 + trailerSize || !value.startsWith("bplist00"))
+        return {};
+    const auto d = reinterpret_cast<const uchar *>(value.constData());
+    const uchar *trailer = d + value.size() - trailerSize;
+    const int offsetSize = trailer[6];
+    const int refSize = trailer[7];
+    const quint64 objectCount = readBigEndian(trailer + 8, 8);
+    const quint64 topObject = readBigEndian(trailer + 16, 8);
+    const quint64 offsetTable = readBigEndian(trailer + 24, 8);
+    const auto tableEnd = quint64(value.size() - trailerSize);
+    if (offsetSize < 1 || offsetSize > 8 || refSize < 1 || refSize > 8 || objectCount > tableEnd
+        || topObject >= objectCount || offsetTable > tableEnd
+        || objectCount * offsetSize > tableEnd - offsetTable) {
+        return {};
+    }
+    // objects are between the header and the offset table
+    const auto objectOffset = [&](quint64 ref) -> std::optional<quint64> {
+        if (ref >= objectCount)
+            return {};
+        const quint64 offset = readBigEndian(d + offsetTable + ref * offsetSize, offsetSize);
+        if (offset < 8 || offset >= offsetTable)
+            return {};
+        return offset;
+    };
+    // the count is in the marker, or follows as an integer object if it does not fit
+    const auto readCount = [&](quint64 &pos) -> std::optional<quint64> {
+        const quint64 count = d[pos++] & 0xf;
+        if (count != 0xf)
+            return count;
+        if (pos >= offsetTable || (d[pos] & 0xf0) != 0x10)
+            return {};
+        const int size = 1 << (d[pos++] & 0xf);
+        if (size > 8 || pos + size > offsetTable)
+            return {};
+        const quint64 result = readBigEndian(d + pos, size);
+        pos += size;
+        return result;
+    };
+
+    std::optional<quint64> pos = objectOffset(topObject);
+    if (!pos || (d[*pos] & 0xf0) != 0xa0)
+        return {};
+    const std::optional<quint64> count = readCount(*pos);
+    if (!count || *count > (offsetTable - *pos) / refSize)
+        return {};
+    QList<QString> result;
+    result.reserve(qsizetype(*count));
+    for (quint64 i = 0; i < *count; ++i) {
+        const quint64 ref = readBigEndian(d + *pos + i * refSize, refSize);
+        std::optional<quint64> stringPos = objectOffset(ref);
+        if (!stringPos)
+            return {};
+        const uchar type = d[*stringPos] & 0xf0;
+        const std::optional<quint64> length = readCount(*stringPos);
+        if (!length)
+            return {};
+        if (type == 0x50) { // ASCII
+            if (*length > offsetTable - *stringPos)
+                return {};
+            result.append(QString::fromLatin1(reinterpret_cast<const char *>(d + *stringPos),
+                                              qsizetype(*length)));
+        } else if (type == 0x60) { // UTF-16 big endian
+            if (*length > (offsetTable - *stringPos) / 2)
+                return {};
+            QString s(qsizetype(*length), Qt::Uninitialized);
+            for (quint64 c = 0; c < *length; ++c)
+                s[qsizetype(c)] = QChar(char16_t(readBigEndian(d + *stringPos + 2 * c, 2)));
+            result.append(s);
+        } else {
+            return {};
+        }
+    }
+    return result;
+}
+
+
+static QByteArray attributeValueFromTags(const QList<QString> &tags)
+{
+#ifdef Q_OS_MACOS
+    Plist::array_type array;
+    std::transform(tags.cbegin(), tags.cend(), std::back_inserter(array), [](const QString &v) {
+        return v.toStdString();
+    });
+    std::vector<char> data;
+    Plist::writePlistBinary(data, array);
+    return QByteArray(data.data(), data.size());
+#else
+    return joinTags(tags);
+#endif
+}
+
+namespace {
+
+class AttributeTagBackend : public Util::TagBackend
+{
+public:
+    std::optional<QList<QString>> read(const QString &filePath,
+                                       const Util::FileStat *stat,
+                                       const std::optional<QByteArray> &attribute) override
+    {
+        if (attribute)
+            return tagsFromValue(*attribute);
+        // stat data from the fallback path has no device
+        const bool hasDevice = stat && stat->inode != 0;
+        if (hasDevice && isUnsupported(stat->device))
+            return {};
+        const std::optional<QByteArray> value = qgetxattr(filePath, kTagsAttribute);
+#ifdef Q_OS_UNIX
+        if (!value && hasDevice && isUnsupportedError(errno)) {
+            QMutexLocker locker(&m_mutex);
+            m_unsupportedDevices.insert(stat->device);
+        }
+#endif
+        return value ? tagsFromValue(*value) : std::nullopt;
+    }
+
+    bool write(const QString &filePath, const QList<QString> &tags) override
+    {
+        const int result = tags.isEmpty()
+                               ? qremovexattr(filePath, kTagsAttribute)
+                               : qsetxattr(filePath, kTagsAttribute, attributeValueFromTags(tags));
+        return result == 0;
+    }
+
+private:
+    static std::optional<QList<QString>> tagsFromValue(const QByteArray &value)
+    {
+        // an empty value is the same as no value
+        if (value.isEmpty())
+            return {};
+        return Util::tagsFromAttributeValue(value);
+    }
+
+    bool isUnsupported(quint64 device)
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_unsupportedDevices.contains(device);
+    }
+
+    QMutex m_mutex;
+    QSet<quint64> m_unsupportedDevices;
+};
+
+} // namespace
+
 namespace Util {
 
-QList<QString> getTags(const QString &filepath)
+const char *tagsAttributeName()
 {
-    const auto optAttrValue = qgetxattr(filepath, kItemUserTags);
-    if (!optAttrValue)
+    return kTagsAttribute;
+}
+
+QList<QString> tagsFromAttributeValue(const QByteArray &value)
+{
+    if (value.isEmpty())
         return {};
+    if (std::optional<QList<QString>> tags = decodeStringArray(value))
+        return *tags;
+#ifndef Q_OS_MACOS
+    if (!value.startsWith("bplist") && !value.startsWith("<?xml"))
+        return splitTags(QString::fromUtf8(value));
+#endif
+    // for example XML property lists
     boost::any result;
-    Plist::readPlist(optAttrValue->data(), optAttrValue->size(), result);
+    Plist::readPlist(value.data(), value.size(), result);
     try {
         const auto key = boost::any_cast<Plist::array_type>(result);
         QList<QString> ret;
@@ -66,16 +344,26 @@ QList<QString> getTags(const QString &filepath)
     return {};
 }
 
-bool setTags(const QString &filePath, const QList<QString> &tags)
+std::unique_ptr<TagBackend> createAttributeTagBackend()
 {
-    Plist::array_type array;
-    std::transform(tags.cbegin(), tags.cend(), std::back_inserter(array), [](const QString &v) {
-        return v.toStdString();
-    });
-    std::vector<char> data;
-    Plist::writePlistBinary(data, array);
-    const QByteArray bData(data.data(), data.size());
-    return qsetxattr(filePath, kItemUserTags, bData);
+    return std::make_unique<AttributeTagBackend>();
+}
+
+QList<QString> getTags(const QString &filepath)
+{
+    return TagStore::instance().tags(filepath);
+}
+
+QList<QString> getTags(const QString &filePath,
+                       const FileStat &stat,
+                       const std::optional<QByteArray> &attribute)
+{
+    return TagStore::instance().tags(filePath, &stat, attribute);
+}
+
+void setTags(const QString &filePath, const QList<QString> &tags)
+{
+    TagStore::instance().setTags(filePath, tags);
 }
 
 } // namespace Util
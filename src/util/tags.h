@@ -1,13 +1,29 @@
 #pragma once
 
+#include "fileprobe.h"
+
+#include <QByteArray>
 #include <QList>
 #include <QString>
 
 namespace Util {
 
-// retrieves kMDItemUserTags
+// name of the extended attribute that stores tags, kMDItemUserTags on macOS and user.xdg.tags
+// elsewhere
+const char *tagsAttributeName();
+// parses the value of the tags extended attribute
+// user.xdg.tags is a comma separated list, commas and backslashes in tags are escaped with a
+// backslash
+QList<QString> tagsFromAttributeValue(const QByteArray &value);
+
+// retrieves tags from the TagStore
 QList<QString> getTags(const QString &filePath);
-// sets kMDItemUserTags
-bool setTags(const QString &filePath, const QList<QString> &tags);
+// retrieves tags from the TagStore, stat detects changes of cached tags
+// attribute is the attribute value if it was already read
+QList<QString> getTags(const QString &filePath,
+                       const FileStat &stat,
+                       const std::optional<QByteArray> &attribute = {});
+// sets tags in the TagStore, they are written shortly after
+void setTags(const QString &filePath, const QList<QString> &tags);
 
 } // namespace Util
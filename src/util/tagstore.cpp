@@ -0,0 +1,506 @@
+#include "tagstore.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QSaveFile>
+#include <QTimer>
+
+#include <exiv2/exiv2.hpp>
+
+#include <algorithm>
+#include <utility>
+
+Q_LOGGING_CATEGORY(logTags, "util.tags", QtWarningMsg)
+
+// files with tags that are remembered
+const int kTagCacheSize = 100000;
+// toggling several tags in a row results in a single write
+const int kWriteDelayMs = 500;
+const char kDatabaseFileName[] = ".photobrowser-tags.json";
+const char kSubjectKey[] = "Xmp.dc.subject";
+
+static std::string encodedPath(const QString &filePath)
+{
+    return QFile::encodeName(filePath).toStdString();
+}
+
+namespace {
+
+class SidecarTagBackend : public Util::TagBackend
+{
+public:
+    std::optional<QList<QString>> read(const QString &filePath,
+                                       const Util::FileStat *,
+                                       const std::optional<QByteArray> &) override
+    {
+        QMutexLocker locker(&m_mutex);
+        const std::optional<QString> sidecar = existingSidecar(filePath);
+        if (!sidecar)
+            return {};
+        try {
+            auto image = Exiv2::ImageFactory::open(encodedPath(*sidecar));
+            image->readMetadata();
+            const Exiv2::XmpData &xmpData = image->xmpData();
+            const auto subject = xmpData.findKey(Exiv2::XmpKey(kSubjectKey));
+            if (subject == xmpData.end())
+                return {};
+            QList<QString> tags;
+            for (size_t i = 0; i < subject->count(); ++i)
+                tags.append(QString::fromStdString(subject->toString(i)));
+            return tags;
+        } catch (const std::exception &e) {
+            qCDebug(logTags) << "cannot read sidecar" << *sidecar << e.what();
+        }
+        return {};
+    }
+
+    bool write(const QString &filePath, const QList<QString> &tags) override
+    {
+        QMutexLocker locker(&m_mutex);
+        const std::optional<QString> existing = existingSidecar(filePath);
+        const QFileInfo fi(filePath);
+        const QString sidecar = existing ? *existing : fi.filePath() + ".xmp";
+        try {
+            auto image = existing
+                             ? Exiv2::ImageFactory::open(encodedPath(sidecar))
+                             : Exiv2::ImageFactory::create(Exiv2::ImageType::xmp,
+                                                           encodedPath(sidecar));
+            if (existing)
+                image->readMetadata();
+            Exiv2::XmpData &xmpData = image->xmpData();
+            const auto subject = xmpData.findKey(Exiv2::XmpKey(kSubjectKey));
+            if (subject != xmpData.end())
+                xmpData.erase(subject);
+            if (!tags.isEmpty()) {
+                Exiv2::XmpArrayValue value(Exiv2::xmpBag);
+                for (const QString &tag : tags)
+                    value.read(tag.toStdString());
+                xmpData.add(Exiv2::XmpKey(kSubjectKey), &value);
+            }
+            image->writeMetadata();
+        } catch (const std::exception &e) {
+            qCDebug(logTags) << "cannot write sidecar" << sidecar << e.what();
+            return false;
+        }
+        if (!existing)
+            sidecars(fi.path()).insert(QFileInfo(sidecar).fileName().toLower(),
+                                       QFileInfo(sidecar).fileName());
+        return true;
+    }
+
+    void reload() override
+    {
+        QMutexLocker locker(&m_mutex);
+        m_sidecars.clear();
+    }
+
+private:
+    std::optional<QString> existingSidecar(const QString &filePath)
+    {
+        const QFileInfo fi(filePath);
+        const QHash<QString, QString> &names = sidecars(fi.path());
+        if (names.isEmpty())
+            return {};
+        for (const QString &name : {fi.fileName() + ".xmp", fi.completeBaseName() + ".xmp"}) {
+            const auto it = names.constFind(name.toLower());
+            if (it != names.cend())
+                return fi.path() + '/' + *it;
+        }
+        return {};
+    }
+
+    // lower case name to name of the sidecars in a directory, listed once per directory,
+    // so files without sidecar do not cost any I/O
+    QHash<QString, QString> &sidecars(const QString &dirPath)
+    {
+        auto it = m_sidecars.find(dirPath);
+        if (it == m_sidecars.end()) {
+            QHash<QString, QString> names;
+            const QStringList entries = QDir(dirPath).entryList({"*.xmp"}, QDir::Files);
+            for (const QString &name : entries)
+                names.insert(name.toLower(), name);
+            it = m_sidecars.insert(dirPath, names);
+        }
+        return *it;
+    }
+
+    QMutex m_mutex;
+    QHash<QString, QHash<QString, QString>> m_sidecars;
+};
+
+class Database
+{
+public:
+    class Change
+    {
+    public:
+        QString filePath;
+        std::optional<QList<QString>> previousTags;
+    };
+
+    QString rootPath;
+    bool isLoaded = false;
+    // relative path to tags
+    QHash<QString, QList<QString>> tags;
+    // relative path to the change that is not saved yet
+    QHash<QString, Change> changes;
+
+    QString filePath() const { return rootPath + '/' + kDatabaseFileName; }
+
+    void load()
+    {
+        if (isLoaded)
+            return;
+        isLoaded = true;
+        QFile file(filePath());
+        if (!file.open(QIODevice::ReadOnly))
+            return;
+        const QJsonObject files = QJsonDocument::fromJson(file.readAll())
+                                      .object()
+                                      .value("files")
+                                      .toObject();
+        for (auto it = files.constBegin(); it != files.constEnd(); ++it) {
+            QList<QString> fileTags;
+            for (const QJsonValue &tag : it.value().toArray())
+                fileTags.append(tag.toString());
+            tags.insert(it.key(), fileTags);
+        }
+    }
+
+    bool save()
+    {
+        QJsonObject files;
+        for (auto it = tags.cbegin(); it != tags.cend(); ++it)
+            files.insert(it.key(), QJsonArray::fromStringList(it.value()));
+        QSaveFile file(filePath());
+        if (!file.open(QIODevice::WriteOnly))
+            return false;
+        file.write(QJsonDocument(QJsonObject{{"version", 1}, {"files", files}}).toJson());
+        return file.commit();
+    }
+
+    void revert()
+    {
+        for (auto it = changes.cbegin(); it != changes.cend(); ++it) {
+            if (it->previousTags)
+                tags.insert(it.key(), *it->previousTags);
+            else
+                tags.remove(it.key());
+        }
+    }
+};
+
+class JsonTagDatabase : public Util::DatabaseTagBackend
+{
+public:
+    std::optional<QList<QString>> read(const QString &filePath,
+                                       const Util::FileStat *,
+                                       const std::optional<QByteArray> &) override
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_databases.empty())
+            return {};
+        const QString path = canonicalFilePath(filePath);
+        for (Database *database : databasesFor(path)) {
+            database->load();
+            const auto it = database->tags.constFind(relativePath(*database, path));
+            if (it != database->tags.cend())
+                return *it;
+        }
+        return {};
+    }
+
+    bool write(const QString &filePath, const QList<QString> &tags) override
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_databases.empty())
+            return false;
+        const QString path = canonicalFilePath(filePath);
+        const std::vector<Database *> databases = databasesFor(path);
+        if (databases.empty())
+            return false;
+        // the database that has the file already, or the outermost one
+        Database *target = databases.back();
+        for (Database *database : databases) {
+            database->load();
+            if (database->tags.contains(relativePath(*database, path))) {
+                target = database;
+                break;
+            }
+        }
+        const QString key = relativePath(*target, path);
+        if (!target->changes.contains(key)) {
+            const auto previous = target->tags.constFind(key);
+            target->changes.insert(key,
+                                   {filePath,
+                                    previous != target->tags.cend() ? std::make_optional(*previous)
+                                                                    : std::nullopt});
+        }
+        if (tags.isEmpty())
+            target->tags.remove(key);
+        else
+            target->tags.insert(key, tags);
+        return true;
+    }
+
+    void reload() override
+    {
+        QMutexLocker locker(&m_mutex);
+        m_canonicalDirs.clear();
+        for (const std::unique_ptr<Database> &database : m_databases) {
+            // changes that are not committed yet would be lost
+            if (!database->changes.isEmpty())
+                continue;
+            database->isLoaded = false;
+            database->tags.clear();
+        }
+    }
+
+    QList<QString> commit() override
+    {
+        QMutexLocker locker(&m_mutex);
+        QList<QString> failed;
+        for (const std::unique_ptr<Database> &database : m_databases) {
+            if (database->changes.isEmpty())
+                continue;
+            if (!database->save()) {
+                qCDebug(logTags) << "cannot write" << database->filePath();
+                database->revert();
+                for (const Database::Change &change : std::as_const(database->changes))
+                    failed.append(change.filePath);
+            }
+            database->changes.clear();
+        }
+        return failed;
+    }
+
+    void addRoot(const QString &rootPath) override
+    {
+        const QFileInfo fi(rootPath);
+        const QString canonicalPath = fi.canonicalFilePath();
+        const QString path = canonicalPath.isEmpty() ? fi.absoluteFilePath() : canonicalPath;
+        QMutexLocker locker(&m_mutex);
+        const bool isKnown = std::any_of(m_databases.cbegin(),
+                                         m_databases.cend(),
+                                         [path](const std::unique_ptr<Database> &database) {
+                                             return database->rootPath == path;
+                                         });
+        if (!isKnown)
+            m_databases.push_back(std::make_unique<Database>(Database{path}));
+    }
+
+private:
+    static QString relativePath(const Database &database, const QString &filePath)
+    {
+        return filePath.mid(database.rootPath.size() + 1);
+    }
+
+    // the roots are canonical, so files below symlinks must be compared with canonical paths too
+    QString canonicalFilePath(const QString &filePath)
+    {
+        const QFileInfo fi(filePath);
+        const QString dirPath = fi.path();
+        auto it = m_canonicalDirs.constFind(dirPath);
+        if (it == m_canonicalDirs.cend()) {
+            const QFileInfo dir(dirPath);
+            const QString canonicalPath = dir.canonicalFilePath();
+            it = m_canonicalDirs.insert(dirPath,
+                                        canonicalPath.isEmpty() ? dir.absoluteFilePath()
+                                                                : canonicalPath);
+        }
+        return *it + '/' + fi.fileName();
+    }
+
+    // the databases with roots that contain the canonical file path, innermost first
+    std::vector<Database *> databasesFor(const QString &filePath) const
+    {
+        std::vector<Database *> result;
+        for (const std::unique_ptr<Database> &database : m_databases) {
+            const QString &root = database->rootPath;
+            if (filePath.size() > root.size() && filePath.startsWith(root)
+                && (root.endsWith('/') || filePath.at(root.size()) == '/')) {
+                result.push_back(database.get());
+            }
+        }
+        std::sort(result.begin(), result.end(), [](const Database *a, const Database *b) {
+            return a->rootPath.size() > b->rootPath.size();
+        });
+        return result;
+    }
+
+    QMutex m_mutex;
+    std::vector<std::unique_ptr<Database>> m_databases;
+    // directory path to canonical directory path
+    QHash<QString, QString> m_canonicalDirs;
+};
+
+} // namespace
+
+namespace Util {
+
+TagBackend::~TagBackend() = default;
+
+void TagBackend::reload() {}
+
+std::unique_ptr<TagBackend> createSidecarTagBackend()
+{
+    return std::make_unique<SidecarTagBackend>();
+}
+
+std::unique_ptr<DatabaseTagBackend> createDatabaseTagBackend()
+{
+    return std::make_unique<JsonTagDatabase>();
+}
+
+TagStore &TagStore::instance()
+{
+    static TagStore store;
+    return store;
+}
+
+TagStore::TagStore()
+    : m_attribute(createAttributeTagBackend())
+    , m_sidecar(createSidecarTagBackend())
+    , m_database(createDatabaseTagBackend())
+    , m_readOrder({m_attribute.get(), m_sidecar.get(), m_database.get()})
+    , m_writeOrder({m_attribute.get(), m_database.get(), m_sidecar.get()})
+    , m_cache(kTagCacheSize)
+{
+    m_flushPool.setMaxThreadCount(1);
+}
+
+TagStore::~TagStore()
+{
+    m_flushPool.waitForDone();
+}
+
+QList<QString> TagStore::tags(const QString &filePath,
+                              const FileStat *stat,
+                              const std::optional<QByteArray> &attribute)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        const auto pending = m_pendingWrites.constFind(filePath);
+        if (pending != m_pendingWrites.cend())
+            return pending->tags;
+        // changing the attribute changes the ctime
+        if (const Entry *cached = m_cache.object(filePath)) {
+            if (!stat || cached->changeTime == stat->changeTime)
+                return cached->tags;
+        }
+    }
+    auto entry = new Entry;
+    if (stat)
+        entry->changeTime = stat->changeTime;
+    for (TagBackend *backend : m_readOrder) {
+        if (std::optional<QList<QString>> tags = backend->read(filePath, stat, attribute)) {
+            entry->tags = *tags;
+            entry->source = backend;
+            break;
+        }
+    }
+    const QList<QString> tags = entry->tags;
+    QMutexLocker locker(&m_mutex);
+    m_cache.insert(filePath, entry);
+    return tags;
+}
+
+void TagStore::setTags(const QString &filePath, const QList<QString> &tags)
+{
+    QMutexLocker locker(&m_mutex);
+    Entry entry;
+    if (const Entry *cached = m_cache.object(filePath))
+        entry = *cached;
+    else if (const auto pending = m_pendingWrites.constFind(filePath);
+             pending != m_pendingWrites.cend())
+        entry = *pending;
+    entry.tags = tags;
+    m_pendingWrites.insert(filePath, entry);
+    m_cache.remove(filePath);
+    scheduleFlush();
+}
+
+void TagStore::flush()
+{
+    QMutexLocker flushLocker(&m_flushMutex);
+    QHash<QString, Entry> writes;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_isFlushScheduled = false;
+        writes = m_pendingWrites;
+    }
+    for (auto it = writes.begin(); it != writes.end(); ++it) {
+        Entry &entry = it.value();
+        // back to where the tags came from, so they are not shadowed by another backend
+        if (!entry.source || !entry.source->write(it.key(), entry.tags)) {
+            const auto backend = std::find_if(m_writeOrder.cbegin(),
+                                              m_writeOrder.cend(),
+                                              [&](TagBackend *backend) {
+                                                  return backend != entry.source
+                                                         && backend->write(it.key(), entry.tags);
+                                              });
+            entry.source = backend == m_writeOrder.cend() ? nullptr : *backend;
+            if (!entry.source)
+                qCDebug(logTags) << "cannot store tags for" << it.key();
+        }
+    }
+    // each changed database is saved once, files in databases that cannot be saved go elsewhere
+    const QList<QString> uncommitted = m_database->commit();
+    for (const QString &filePath : uncommitted) {
+        Entry &entry = writes[filePath];
+        const auto backend = std::find_if(m_writeOrder.cbegin(),
+                                          m_writeOrder.cend(),
+                                          [&](TagBackend *backend) {
+                                              return backend != m_database.get()
+                                                     && backend->write(filePath, entry.tags);
+                                          });
+        entry.source = backend == m_writeOrder.cend() ? nullptr : *backend;
+        if (!entry.source)
+            qCDebug(logTags) << "cannot store tags for" << filePath;
+    }
+    QMutexLocker locker(&m_mutex);
+    for (auto it = writes.cbegin(); it != writes.cend(); ++it) {
+        // tags could have been changed again in the meantime
+        const auto pending = m_pendingWrites.constFind(it.key());
+        if (pending == m_pendingWrites.cend() || pending->tags != it->tags)
+            continue;
+        m_pendingWrites.remove(it.key());
+        // the change time is not known, so the next read with stat data reads the tags again
+        m_cache.insert(it.key(), new Entry{{}, it->tags, it->source});
+    }
+}
+
+void TagStore::addDatabaseRoot(const QString &rootPath)
+{
+    m_database->addRoot(rootPath);
+}
+
+void TagStore::reload()
+{
+    for (TagBackend *backend : m_readOrder)
+        backend->reload();
+    QMutexLocker locker(&m_mutex);
+    m_cache.clear();
+}
+
+// call with m_mutex locked
+void TagStore::scheduleFlush()
+{
+    if (m_isFlushScheduled)
+        return;
+    auto app = QCoreApplication::instance();
+    if (!app)
+        return;
+    m_isFlushScheduled = true;
+    QTimer::singleShot(kWriteDelayMs, app, [this] {
+        m_flushPool.start([this] { flush(); });
+    });
+}
+
+} // namespace Util
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "fileprobe.h"
+
+#include <QCache>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace Util {
+
+// A place where tags of files are stored. Implementations must be thread-safe.
+class TagBackend
+{
+public:
+    virtual ~TagBackend();
+
+    // std::nullopt if the backend does not have tags for the file
+    // attribute is the value of the extended attribute with tagsAttributeName() if it was read
+    virtual std::optional<QList<QString>> read(const QString &filePath,
+                                               const FileStat *stat,
+                                               const std::optional<QByteArray> &attribute)
+        = 0;
+    // false if the backend cannot store tags for the file, true when they are stored
+    virtual bool write(const QString &filePath, const QList<QString> &tags) = 0;
+    // forgets cached file system state, so changes by others are seen
+    virtual void reload();
+};
+
+class DatabaseTagBackend : public TagBackend
+{
+public:
+    // files below rootPath can have their tags in a database file in rootPath
+    virtual void addRoot(const QString &rootPath) = 0;
+    // write() only stages changes, this saves each changed database once
+    // returns the files whose changes were dropped because their database could not be saved
+    virtual QList<QString> commit() = 0;
+};
+
+// Extended attribute of the file, kMDItemUserTags on macOS and user.xdg.tags elsewhere.
+// Devices that do not support extended attributes are remembered and skipped.
+std::unique_ptr<TagBackend> createAttributeTagBackend();
+// dc:subject of an XMP sidecar next to the file, "name.ext.xmp" or "name.xmp".
+std::unique_ptr<TagBackend> createSidecarTagBackend();
+// A JSON file in each root directory, for file systems without extended attributes.
+std::unique_ptr<DatabaseTagBackend> createDatabaseTagBackend();
+
+// Reads tags from the first backend that has them, and writes them back to the same backend, or
+// the first one that accepts them for files that did not have tags.
+// Read results are cached, and writes are collected and done together shortly after.
+class TagStore
+{
+public:
+    static TagStore &instance();
+
+    // stat is used to detect changes of cached tags
+    QList<QString> tags(const QString &filePath,
+                        const FileStat *stat = nullptr,
+                        const std::optional<QByteArray> &attribute = {});
+    // updates the cache immediately, the write happens with the next flush
+    void setTags(const QString &filePath, const QList<QString> &tags);
+    // writes all pending changes
+    void flush();
+
+    void addDatabaseRoot(const QString &rootPath);
+    // forgets cached tags, for example when a directory is loaded again
+    void reload();
+
+private:
+    TagStore();
+    ~TagStore();
+
+    class Entry
+    {
+    public:
+        QDateTime changeTime;
+        QList<QString> tags;
+        TagBackend *source = nullptr;
+    };
+
+    void scheduleFlush();
+
+    std::unique_ptr<TagBackend> m_attribute;
+    std::unique_ptr<TagBackend> m_sidecar;
+    std::unique_ptr<DatabaseTagBackend> m_database;
+    // sidecars are interoperable, so they are preferred for reading, but a database is preferred
+    // over creating lots of new files
+    std::vector<TagBackend *> m_readOrder;
+    std::vector<TagBackend *> m_writeOrder;
+
+    QMutex m_mutex;
+    QCache<QString, Entry> m_cache;
+    QHash<QString, Entry> m_pendingWrites;
+    bool m_isFlushScheduled = false;
+    // only one flush at a time
+    QMutex m_flushMutex;
+    // destroyed first, which waits for a running flush
+    QThreadPool m_flushPool;
+};
+
+} // namespace Util
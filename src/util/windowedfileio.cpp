@@ -0,0 +1,230 @@
+#include "windowedfileio.h"
+
+#include <QFileInfo>
+
+#include <exiv2/error.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+// meta data blocks are usually small, so keep the read granularity close to a few pages
+const qint64 kBlockSize = 16 * 1024;
+// parsers mostly read forward, so few blocks are read again
+const std::size_t kMaxCachedBlocks = 16;
+
+namespace Util {
+
+WindowedFileIo::WindowedFileIo(const QString &filePath,
+                               const QByteArray &header,
+                               std::optional<qint64> fileSize,
+                               std::optional<qint64> maxBytesRead)
+    : m_file(filePath)
+    , m_path(filePath.toStdString())
+    , m_header(header)
+    , m_size(fileSize ? *fileSize : QFileInfo(filePath).size())
+    , m_maxBytesRead(maxBytesRead)
+{
+    if (m_header.size() > m_size)
+        m_header.truncate(m_size);
+}
+
+WindowedFileIo::~WindowedFileIo()
+{
+    munmap();
+}
+
+int WindowedFileIo::open()
+{
+    m_position = 0;
+    m_isEof = false;
+    m_hasError = false;
+    // the file itself is opened lazily, when the header is not enough
+    m_isOpen = true;
+    return 0;
+}
+
+int WindowedFileIo::close()
+{
+    munmap();
+    m_file.close();
+    m_isOpen = false;
+    return 0;
+}
+
+size_t WindowedFileIo::write(const Exiv2::byte *, size_t)
+{
+    return 0;
+}
+
+size_t WindowedFileIo::write(Exiv2::BasicIo &)
+{
+    return 0;
+}
+
+int WindowedFileIo::putb(Exiv2::byte)
+{
+    return EOF;
+}
+
+Exiv2::DataBuf WindowedFileIo::read(size_t rcount)
+{
+    // corrupt length fields must not allocate more than the file has
+    const auto available = size_t(std::max<qint64>(0, m_size - m_position));
+    Exiv2::DataBuf buf(std::min(rcount, available));
+    const size_t readCount = read(buf.data(), buf.size());
+    buf.resize(readCount);
+    return buf;
+}
+
+size_t WindowedFileIo::read(Exiv2::byte *buf, size_t rcount)
+{
+    const auto available = std::max<qint64>(0, m_size - m_position);
+    const auto count = std::min<qint64>(qint64(rcount), available);
+    qint64 done = 0;
+    while (done < count) {
+        const qint64 position = m_position + done;
+        const char *source = nullptr;
+        qint64 sourceSize = 0;
+        if (position < m_header.size()) {
+            source = m_header.constData() + position;
+            sourceSize = m_header.size() - position;
+        } else {
+            const QByteArray *data = block(position / kBlockSize);
+            const qint64 offset = position % kBlockSize;
+            if (!data || offset >= data->size()) {
+                m_hasError = true;
+                break;
+            }
+            source = data->constData() + offset;
+            sourceSize = data->size() - offset;
+        }
+        const qint64 n = std::min(sourceSize, count - done);
+        std::memcpy(buf + done, source, size_t(n));
+        done += n;
+    }
+    m_position += done;
+    if (qint64(rcount) > done)
+        m_isEof = true;
+    return size_t(done);
+}
+
+int WindowedFileIo::getb()
+{
+    Exiv2::byte b;
+    if (read(&b, 1) != 1)
+        return EOF;
+    return b;
+}
+
+void WindowedFileIo::transfer(Exiv2::BasicIo &)
+{
+    throw Exiv2::Error(Exiv2::ErrorCode::kerFunctionNotSupported, "WindowedFileIo::transfer");
+}
+
+int WindowedFileIo::seek(int64_t offset, Position pos)
+{
+    qint64 position = 0;
+    switch (pos) {
+    case Exiv2::BasicIo::beg:
+        position = offset;
+        break;
+    case Exiv2::BasicIo::cur:
+        position = m_position + offset;
+        break;
+    case Exiv2::BasicIo::end:
+        position = m_size + offset;
+        break;
+    }
+    if (position < 0)
+        return 1;
+    if (position > m_size) {
+        m_isEof = true;
+        return 1;
+    }
+    m_position = position;
+    m_isEof = false;
+    return 0;
+}
+
+Exiv2::byte *WindowedFileIo::mmap(bool isWriteable)
+{
+    if (isWriteable)
+        throw Exiv2::Error(Exiv2::ErrorCode::kerFunctionNotSupported, "WindowedFileIo::mmap");
+    // some parsers want to see the whole file, pages are only read when they are accessed
+    if (!m_map) {
+        if (!m_file.isOpen() && !m_file.open(QIODevice::ReadOnly))
+            throw Exiv2::Error(Exiv2::ErrorCode::kerCallFailed, m_path, "open", "mmap");
+        m_map = m_file.map(0, m_size);
+        if (!m_map)
+            throw Exiv2::Error(Exiv2::ErrorCode::kerCallFailed, m_path, "map", "mmap");
+    }
+    return m_map;
+}
+
+int WindowedFileIo::munmap()
+{
+    if (m_map) {
+        m_file.unmap(m_map);
+        m_map = nullptr;
+    }
+    return 0;
+}
+
+size_t WindowedFileIo::tell() const
+{
+    return size_t(m_position);
+}
+
+size_t WindowedFileIo::size() const
+{
+    return size_t(m_size);
+}
+
+bool WindowedFileIo::isopen() const
+{
+    return m_isOpen;
+}
+
+int WindowedFileIo::error() const
+{
+    return m_hasError ? 1 : 0;
+}
+
+bool WindowedFileIo::eof() const
+{
+    return m_isEof;
+}
+
+const std::string &WindowedFileIo::path() const noexcept
+{
+    return m_path;
+}
+
+void WindowedFileIo::populateFakeData() {}
+
+const QByteArray *WindowedFileIo::block(qint64 index)
+{
+    const auto it = m_blocks.find(index);
+    if (it != m_blocks.end())
+        return &it->second;
+    if (m_maxBytesRead && m_bytesRead + kBlockSize > *m_maxBytesRead)
+        return nullptr;
+    if (!m_file.isOpen() && !m_file.open(QIODevice::ReadOnly))
+        return nullptr;
+    if (!m_file.seek(index * kBlockSize))
+        return nullptr;
+    const QByteArray data = m_file.read(kBlockSize);
+    if (data.isEmpty())
+        return nullptr;
+    m_bytesRead += data.size();
+    // the returned block stays valid until the next call
+    if (m_blockOrder.size() >= kMaxCachedBlocks) {
+        m_blocks.erase(m_blockOrder.front());
+        m_blockOrder.pop_front();
+    }
+    m_blockOrder.push_back(index);
+    return &m_blocks.emplace(index, data).first->second;
+}
+
+} // namespace Util
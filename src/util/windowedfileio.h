@@ -0,0 +1,68 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+
+#include <exiv2/basicio.hpp>
+
+#include <deque>
+#include <optional>
+#include <unordered_map>
+
+namespace Util {
+
+// Read-only exiv2 I/O that only reads the parts of the file that the parser asks for, in blocks
+// of which the most recently read ones are cached. It can be seeded with the first bytes of the
+// file, so parsing meta data from the start of the file does not need any further I/O.
+// Reads fail when they would exceed maxBytesRead. Parsers that map the file only read the pages
+// they access, which is not limited.
+class WindowedFileIo : public Exiv2::BasicIo
+{
+public:
+    WindowedFileIo(const QString &filePath,
+                   const QByteArray &header = {},
+                   std::optional<qint64> fileSize = {},
+                   std::optional<qint64> maxBytesRead = {});
+    ~WindowedFileIo() override;
+
+    int open() override;
+    int close() override;
+    size_t write(const Exiv2::byte *data, size_t wcount) override;
+    size_t write(Exiv2::BasicIo &src) override;
+    int putb(Exiv2::byte data) override;
+    Exiv2::DataBuf read(size_t rcount) override;
+    size_t read(Exiv2::byte *buf, size_t rcount) override;
+    int getb() override;
+    void transfer(Exiv2::BasicIo &src) override;
+    int seek(int64_t offset, Position pos) override;
+    Exiv2::byte *mmap(bool isWriteable = false) override;
+    int munmap() override;
+    size_t tell() const override;
+    size_t size() const override;
+    bool isopen() const override;
+    int error() const override;
+    bool eof() const override;
+    const std::string &path() const noexcept override;
+    void populateFakeData() override;
+
+private:
+    const QByteArray *block(qint64 index);
+
+    QFile m_file;
+    std::string m_path;
+    QByteArray m_header;
+    std::unordered_map<qint64, QByteArray> m_blocks;
+    // indices of the cached blocks, oldest first
+    std::deque<qint64> m_blockOrder;
+    qint64 m_size = 0;
+    qint64 m_position = 0;
+    // bytes read from the file, not counting the header
+    qint64 m_bytesRead = 0;
+    std::optional<qint64> m_maxBytesRead;
+    uchar *m_map = nullptr;
+    bool m_isOpen = false;
+    bool m_isEof = false;
+    bool m_hasError = false;
+};
+
+} // namespace Util